@@ -0,0 +1,291 @@
+// Replays a flight recorder log (src/flight_recorder.hpp) through the Pixy2 driver on the PC,
+// see bench/README.md.
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../src/flight_log.hpp"
+#include "../src/pixy2/link_mock.hpp"
+#include "../src/pixy2/pixy2.hpp"
+
+using namespace pixy2;
+using namespace flight;
+
+struct Transaction {
+    uint32_t timeUs;
+    esp_err_t err;
+    uint32_t durationUs;
+    std::vector<uint8_t> request;
+    std::vector<uint8_t> response;
+};
+
+struct Log {
+    std::vector<Transaction> transactions;
+    uint32_t motorRecords = 0;
+    uint32_t pages = 0;
+    uint32_t missingPages = 0;
+};
+
+// The request the driver built in the replay, to compare with the recorded one.
+struct Captured {
+    std::vector<uint8_t> request;
+};
+
+static void captureHook(const uint8_t *request, size_t requestLen, const PacketResponse&, esp_err_t, void *ctx) {
+    ((Captured*)ctx)->request.assign(request, request + requestLen);
+}
+
+static bool loadRun(const std::vector<uint8_t>& image, int wantedRun, bool verbose, Log& log) {
+    std::map<uint16_t, std::vector<const uint8_t*>> runs;
+    for (size_t off = 0; off + PAGE_SIZE <= image.size(); off += PAGE_SIZE) {
+        PageHeader h;
+        memcpy(&h, image.data() + off, sizeof(h));
+        if (h.magic == PAGE_MAGIC && ((h.used >= sizeof(h) && h.used <= PAGE_SIZE) || h.used == PAGE_USED_UNKNOWN)) {
+            runs[h.run].push_back(image.data() + off);
+        }
+    }
+    if (runs.empty()) {
+        fprintf(stderr, "no pages found\n");
+        return false;
+    }
+
+    // the newest, across the wrap of the run counter
+    uint16_t run = runs.begin()->first;
+    for (const auto& r : runs) {
+        printf("run %u: %zu pages\n", r.first, r.second.size());
+        if (int16_t(r.first - run) > 0) {
+            run = r.first;
+        }
+    }
+    if (wantedRun >= 0) {
+        run = wantedRun;
+    }
+    if (runs.count(run) == 0) {
+        fprintf(stderr, "run %d not found\n", wantedRun);
+        return false;
+    }
+    printf("replaying run %u\n", run);
+
+    auto& pages = runs[run];
+    std::sort(pages.begin(), pages.end(), [](const uint8_t *a, const uint8_t *b) {
+        return ((const PageHeader*)a)->seq < ((const PageHeader*)b)->seq;
+    });
+
+    uint32_t expectedSeq = 0;
+    for (const uint8_t *page : pages) {
+        PageHeader h;
+        memcpy(&h, page, sizeof(h));
+        log.missingPages += h.seq - expectedSeq;
+        expectedSeq = h.seq + 1;
+        ++log.pages;
+
+        // an unfinished page ends at the erased flash
+        const bool unfinished = h.used == PAGE_USED_UNKNOWN;
+        const size_t used = unfinished ? PAGE_SIZE : h.used;
+        if (unfinished) {
+            printf("page %u: unfinished\n", h.seq);
+        }
+        size_t off = sizeof(h);
+        while (off + sizeof(RecordHeader) <= used) {
+            RecordHeader r;
+            memcpy(&r, page + off, sizeof(r));
+            if (unfinished && r.type == 0xFF) {
+                break;
+            }
+            off += sizeof(r);
+            if (off + r.length > used) {
+                fprintf(stderr, "page %u: record cut off\n", h.seq);
+                break;
+            }
+            const uint8_t *payload = page + off;
+            off += r.length;
+
+            if (r.type == PIXY_TRANSACTION && r.length >= sizeof(PixyTransaction)) {
+                PixyTransaction pt;
+                memcpy(&pt, payload, sizeof(pt));
+                if (sizeof(pt) + pt.requestLen > r.length) {
+                    fprintf(stderr, "page %u: bad transaction record\n", h.seq);
+                    continue;
+                }
+                Transaction t;
+                t.timeUs = r.timeUs;
+                t.err = pt.err;
+                t.durationUs = pt.durationUs;
+                t.request.assign(payload + sizeof(pt), payload + sizeof(pt) + pt.requestLen);
+                t.response.assign(payload + sizeof(pt) + pt.requestLen, payload + r.length);
+                log.transactions.push_back(std::move(t));
+            } else if (r.type == MOTORS && r.length == sizeof(MotorsRecord)) {
+                ++log.motorRecords;
+                if (verbose) {
+                    MotorsRecord m;
+                    memcpy(&m, payload, sizeof(m));
+                    printf("%10u us  motors %4d %4d\n", r.timeUs, m.left, m.right);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Responses are recorded cut short when the link failed (timeout, bus error...).
+static bool completePacket(const std::vector<uint8_t>& r) {
+    if (r.size() < 4) {
+        return false;
+    }
+    const size_t headerSize = r[0] == HDR0_CSUM ? 6 : 4;
+    return r.size() >= headerSize && r.size() == headerSize + r[3];
+}
+
+// Calls the same Pixy2 method the robot did, with the arguments from the recorded request.
+static esp_err_t replayOne(Pixy2<LinkMock>& pixy, const Transaction& t, GetBlocksContext& blocks,
+    LineFeaturesContext& lines, uint32_t& decoded) {
+    if (t.request.size() < 4) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *args = t.request.data() + 4;
+    const size_t argc = t.request.size() - 4;
+
+    switch (t.request[2]) {
+    case GET_BLOCKS: {
+        if (argc < 2) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const auto err = pixy.getColorBlocks(args[0], args[1], blocks);
+        decoded += blocks.blocks.size();
+        return err;
+    }
+    case GET_LINE_FEATURES: {
+        if (argc < 2) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const auto err = pixy.getLineFeatures(lines, LineFeatures(args[1]), args[0] != 0);
+        decoded += lines.vectors.size() + lines.intersections.size() + lines.barcodes.size();
+        return err;
+    }
+    case GET_VERSION: {
+        VersionResponse v;
+        return pixy.getVersion(v);
+    }
+    case GET_RESOLUTION: {
+        ResolutionResponse r;
+        return pixy.getResolution(r);
+    }
+    case GET_FPS: {
+        uint32_t fps;
+        return pixy.getFPS(fps);
+    }
+    case SET_LAMP:
+        if (argc < 2) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        return pixy.setLamp(args[0] != 0, args[1] != 0);
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-r run] [-n repeats] [-v] flightlog.bin\n", argv0);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int wantedRun = -1;
+    uint32_t repeats = 1;
+    bool verbose = false;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            wantedRun = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            repeats = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (argv[i][0] != '-' && path == nullptr) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (path == nullptr) {
+        usage(argv[0]);
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        perror(path);
+        return 1;
+    }
+    std::vector<uint8_t> image;
+    uint8_t buf[PAGE_SIZE];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        image.insert(image.end(), buf, buf + n);
+    }
+    fclose(f);
+
+    Log log;
+    if (!loadRun(image, wantedRun, verbose, log)) {
+        return 1;
+    }
+    printf("%u pages (%u missing), %zu transactions, %u motor commands\n",
+        log.pages, log.missingPages, log.transactions.size(), log.motorRecords);
+
+    MockScript script;
+    Pixy2<LinkMock> pixy(LinkMock { script });
+    Captured captured;
+    pixy.setTransactionHook(captureHook, &captured);
+    // The recorded probes after link failures are in the log as plain version requests,
+    // and the PC runs at its own pace.
+    pixy.setRecovery(0, 0);
+    pixy.setCallBudget(0);
+
+    static GetBlocksContext blocks;
+    static LineFeaturesContext lines;
+
+    uint32_t errMismatches = 0, requestMismatches = 0, unsupported = 0, decoded = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t rep = 0; rep < repeats; ++rep) {
+        for (const auto& t : log.transactions) {
+            // Reads past the end of a recorded packet get zeros, like on SPI. A cut short one
+            // stands for a failed link, running out of its bytes times out instead.
+            const bool linkFailed = !completePacket(t.response);
+            script.setUnderrun(linkFailed ? MockScript::UNDERRUN_ERROR : MockScript::UNDERRUN_FILL);
+            script.push(t.response.data(), t.response.size());
+            const esp_err_t err = replayOne(pixy, t, blocks, lines, decoded);
+            if (err == ESP_ERR_NOT_SUPPORTED) {
+                ++unsupported;
+                continue;
+            }
+            // drop what the driver did not read, the next transaction starts clean
+            uint8_t rest[64];
+            while (script.available() > 0) {
+                script.receive(rest, std::min(sizeof(rest), script.available()));
+            }
+
+            // which link error it was is up to the bus, not the data
+            const bool errOk = linkFailed ? t.err != ESP_OK && err == ESP_ERR_TIMEOUT : err == t.err;
+            const bool requestOk = captured.request == t.request;
+            errMismatches += !errOk;
+            requestMismatches += !requestOk;
+            if (rep == 0 && (verbose || !errOk || !requestOk)) {
+                printf("%10u us  type 0x%02x  recorded %d (%u us)  replayed %d%s\n", t.timeUs, t.request[2],
+                    t.err, t.durationUs, err, requestOk ? "" : "  request differs");
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const size_t total = log.transactions.size() * repeats;
+
+    printf("%u result mismatches, %u request mismatches, %u unsupported, %u items decoded\n",
+        errMismatches, requestMismatches, unsupported, decoded);
+    if (total > 0) {
+        printf("%.0f ns per transaction, %.0f transactions/s\n", seconds * 1e9 / total, total / seconds);
+    }
+    return errMismatches == 0 && requestMismatches == 0 ? 0 : 2;
+}
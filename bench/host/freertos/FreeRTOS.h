@@ -0,0 +1,17 @@
+#pragma once
+
+// Host replacement of the few FreeRTOS bits the pixy2 driver uses.
+// One tick is one millisecond, same as the Arduino-ESP32 configuration.
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+#include "FreeRTOS.h"
+
+inline TickType_t xTaskGetTickCount() {
+    using namespace std::chrono;
+    static const auto start = steady_clock::now();
+    return TickType_t(duration_cast<milliseconds>(steady_clock::now() - start).count());
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
@@ -0,0 +1,208 @@
+// Host microbenchmark of the pixy2 driver, see bench/README.md.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/pixy2/link_mock.hpp"
+#include "../src/pixy2/pixy2.hpp"
+
+using namespace pixy2;
+
+static std::atomic<uint32_t> gAllocations(0);
+
+void* operator new(size_t size) {
+    ++gAllocations;
+    void *p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct BenchResult {
+    double nsPerCall;
+    double allocsPerCall;
+    double bytesPerCall;
+    double receiveCallsPerCall;
+    double syncUsPerCall;
+    double skippedPerCall;
+    uint32_t errors;
+};
+
+template<typename Fn>
+static BenchResult run(Pixy2<LinkMock>& pixy, MockScript& script, uint32_t iterations, Fn fn) {
+    // warm up, so lazily allocated buffers are not counted
+    for (uint32_t i = 0; i < 100; ++i) {
+        fn();
+    }
+
+    pixy.resetStats();
+    script.resetCounters();
+    gAllocations = 0;
+
+    BenchResult res = {};
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; ++i) {
+        if (fn() != ESP_OK) {
+            ++res.errors;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    const double n = iterations;
+    res.nsPerCall = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / n;
+    res.allocsPerCall = gAllocations / n;
+    res.bytesPerCall = script.counters().bytesReceived / n;
+    res.receiveCallsPerCall = script.counters().receiveCalls / n;
+    res.syncUsPerCall = pixy.stats().syncTimeUs / n;
+    res.skippedPerCall = pixy.stats().syncBytesSkipped / n;
+    return res;
+}
+
+static void print(const char *name, const BenchResult& r) {
+    printf("%-28s %10.1f %8.2f %8.1f %8.1f %10.3f %8.1f %8u\n", name, r.nsPerCall, r.allocsPerCall,
+        r.bytesPerCall, r.receiveCallsPerCall, r.syncUsPerCall, r.skippedPerCall, r.errors);
+}
+
+int main(int argc, char **argv) {
+    const uint32_t iterations = argc > 1 ? atoi(argv[1]) : 100000;
+
+    ColorBlock blocks[4];
+    for (uint16_t i = 0; i < 4; ++i) {
+        blocks[i] = ColorBlock { uint16_t(1 + i), uint16_t(10 * i), 20, 30, 40, 0, uint8_t(i), 5 };
+    }
+
+    const uint8_t version[16] = { 0x22, 0x00, 3, 0, 0x05, 0x00, 'g', 'e', 'n', 'e', 'r', 'a', 'l' };
+
+    uint8_t lines[2 + 6 * 2 + 2 + 4];
+    lines[0] = LineFeatures::VECTORS;
+    lines[1] = 6 * 2;
+    for (uint8_t i = 0; i < 12; ++i) {
+        lines[2 + i] = i;
+    }
+    lines[14] = LineFeatures::BARCODES;
+    lines[15] = 4;
+    lines[16] = 10;
+    lines[17] = 20;
+    lines[18] = 0;
+    lines[19] = 7;
+
+    printf("%-28s %10s %8s %8s %8s %10s %8s %8s\n", "scenario", "ns/call", "allocs", "bytes",
+        "reads", "sync us", "skipped", "errors");
+
+    {
+        MockScript script;
+        script.respondTo(GET_VERSION, GET_VERSION_RESPONSE, version, sizeof(version));
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        const auto req = Pixy2<LinkMock>::request(GET_VERSION);
+        PacketResponse resp;
+        print("transact(version)", run(pixy, script, iterations, [&]() { return pixy.transact(req, resp); }));
+
+        VersionResponse ver;
+        print("getVersion", run(pixy, script, iterations, [&]() { return pixy.getVersion(ver); }));
+    }
+
+    {
+        MockScript script;
+        script.respondTo(GET_BLOCKS, GET_BLOCKS_RESPONSE, (const uint8_t*)blocks, sizeof(blocks));
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        GetBlocksContext ctx;
+        print("getColorBlocks", run(pixy, script, iterations, [&]() { return pixy.getColorBlocks(0xFF, 4, ctx); }));
+    }
+
+    {
+        MockScript script;
+        script.respondTo(GET_BLOCKS, GET_BLOCKS_RESPONSE, (const uint8_t*)blocks, sizeof(blocks), 20);
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        GetBlocksContext ctx;
+        print("getColorBlocks+20 garbage", run(pixy, script, iterations, [&]() { return pixy.getColorBlocks(0xFF, 4, ctx); }));
+    }
+
+    {
+        MockScript script;
+        script.respondTo(GET_LINE_FEATURES, GET_LINE_FEATURES_RESPONSE, lines, sizeof(lines));
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        LineFeaturesContext ctx;
+        print("getLineFeatures", run(pixy, script, iterations, [&]() { return pixy.getLineFeatures(ctx); }));
+    }
+
+    {
+        MockScript script;
+        script.respondTo(GET_BLOCKS, GET_BLOCKS_RESPONSE, (const uint8_t*)blocks, sizeof(blocks));
+        script.respondTo(GET_LINE_FEATURES, GET_LINE_FEATURES_RESPONSE, lines, sizeof(lines));
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        GetBlocksContext blocksCtx;
+        LineFeaturesContext linesCtx;
+        print("blocks, then lines", run(pixy, script, iterations, [&]() {
+            auto err = pixy.getColorBlocks(0xFF, 4, blocksCtx);
+            return err != ESP_OK ? err : pixy.getLineFeatures(linesCtx);
+        }));
+
+        FrameQuery query;
+        query.maxBlocks = 4;
+        query.lineFeatures = true;
+        FrameContext frame;
+        print("getFrame(blocks+lines)", run(pixy, script, iterations, [&]() { return pixy.getFrame(query, frame); }));
+    }
+
+    {
+        MockScript script;
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        pixy.setRecovery(0, 0); // the error path itself, not the link down fast path
+        GetBlocksContext ctx;
+        print("getColorBlocks bad csum", run(pixy, script, iterations, [&]() {
+            script.pushBadCsumPacket(GET_BLOCKS_RESPONSE, (const uint8_t*)blocks, sizeof(blocks));
+            return pixy.getColorBlocks(0xFF, 4, ctx);
+        }));
+    }
+
+    {
+        MockScript script;
+        script.setUnderrun(MockScript::UNDERRUN_ERROR);
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        pixy.setRecovery(0, 0);
+        GetBlocksContext ctx;
+        print("getColorBlocks short read", run(pixy, script, iterations, [&]() {
+            script.pushShortPacket(GET_BLOCKS_RESPONSE, (const uint8_t*)blocks, sizeof(blocks), 20);
+            return pixy.getColorBlocks(0xFF, 4, ctx);
+        }));
+    }
+
+    {
+        MockScript script;
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        pixy.setRecovery(0, 0);
+        GetBlocksContext ctx;
+        print("getColorBlocks no sync", run(pixy, script, iterations / 10, [&]() { return pixy.getColorBlocks(0xFF, 4, ctx); }));
+    }
+
+    {
+        // same, but the link goes down and the calls fail without touching it
+        MockScript script;
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        GetBlocksContext ctx;
+        print("getColorBlocks link down", run(pixy, script, iterations, [&]() { return pixy.getColorBlocks(0xFF, 4, ctx); }));
+    }
+
+    {
+        // every read would take 5 ms, the deadline cuts the call at 2 ms
+        MockScript script;
+        script.setReceiveDelay(5000);
+        Pixy2<LinkMock> pixy(LinkMock { script });
+        pixy.setRecovery(0, 0);
+        pixy.setCallBudget(2000);
+        GetBlocksContext ctx;
+        print("getColorBlocks stuck, 2 ms", run(pixy, script, std::max(10u, iterations / 1000), [&]() {
+            return pixy.getColorBlocks(0xFF, 4, ctx);
+        }));
+    }
+
+    return 0;
+}
@@ -9,10 +9,12 @@ import threading
 import io
 
 from websocket_server import WebsocketServer
+import telemetry
 
 BROADCAST_PORT = 42424
 WEB_PORT = 9000
 DISCOVER_SLEEP = 0.2
+TELEMETRY_SUBSCRIBE_PERIOD = 1.0
 
 def discover(owner):
     sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -80,9 +82,10 @@ def discover(owner):
     return (addr[0], "http://%s:%d%s" % (addr[0], dev.get("port", 80), dev.get("path", "/index.html")))
 
 class RBSocket:
-    def __init__(self, dest_ip, server):
+    def __init__(self, dest_ip, server, verbose=False):
         self.dest_ip = dest_ip
         self.server = server
+        self.verbose = verbose
         self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
         if sys.platform.startswith("linux"):
             self.sock.setsockopt(socket.SOL_SOCKET, 12, 6)
@@ -100,7 +103,8 @@ class RBSocket:
         msg["n"] = self.write_counter
         self.write_counter += 1
         msg = json.dumps(msg)
-        print(msg)
+        if self.verbose:
+            print(msg)
         try:
             self.sock.sendto(msg.encode("utf-8"), (self.dest_ip, BROADCAST_PORT))
         except Exception as e:
@@ -131,6 +135,52 @@ class RBSocket:
     def wsOnMessage(self, client, server, msg):
         self.send(json.loads(msg))
 
+class TelemetrySocket:
+    """ Receives the binary telemetry (src/telemetry.hpp) and forwards it to the browser as JSON,
+        one websocket message per datagram. """
+    def __init__(self, dest_ip, server, port=telemetry.UDP_PORT, verbose=False):
+        self.dest = (dest_ip, port)
+        self.server = server
+        self.verbose = verbose
+        self.receiver = telemetry.Receiver()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(TELEMETRY_SUBSCRIBE_PERIOD)
+        self.sock.bind(('', 0))
+
+    def subscribe(self):
+        try:
+            self.sock.sendto(b"sub", self.dest)
+        except Exception as e:
+            print(e)
+
+    def process(self):
+        self.subscribe()
+        last_subscribe = time.time()
+        while True:
+            if time.time() - last_subscribe > TELEMETRY_SUBSCRIBE_PERIOD:
+                self.subscribe()
+                last_subscribe = time.time()
+
+            try:
+                data, addr = self.sock.recvfrom(65535)
+            except socket.timeout:
+                continue
+            except Exception as e:
+                print(e)
+                time.sleep(0.1)
+                continue
+
+            try:
+                seq, records = self.receiver.decode(data)
+            except telemetry.DecodeError as e:
+                print(e)
+                continue
+
+            msg = json.dumps({ "c": "telemetry", "seq": seq, "lost": self.receiver.lost, "records": records })
+            if self.verbose:
+                print(msg)
+            self.server.send_message_to_all(msg)
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Mickoflus proxy')
     parser.add_argument("owner", type=str, help="The name of the owner")
@@ -139,6 +189,9 @@ if __name__ == "__main__":
     parser.add_argument("--port", type=int, default=80, help="The port to use.")
     parser.add_argument("--path", type=str, default="/index.html", help="Path to the control page.")
     parser.add_argument("-pp", type=int, default=9000, help="port of the websocket proxy")
+    parser.add_argument("--telemetry-port", type=int, default=telemetry.UDP_PORT,
+        help="UDP port of the binary telemetry, 0 to turn it off.")
+    parser.add_argument("-v", "--verbose", action="store_true", help="Print every message.")
     #parser.add_argument("-ph", type=str, default="0.0.0.0", help="hostname for the websocket proxy")
     args = parser.parse_args()
 
@@ -152,11 +205,17 @@ if __name__ == "__main__":
     webbrowser.open(addr)
 
     server = WebsocketServer(args.pp)
-    rbsocket = RBSocket(device_ip, server)
+    rbsocket = RBSocket(device_ip, server, args.verbose)
     server.set_fn_message_received(rbsocket.wsOnMessage)
 
     th = threading.Thread(target=rbsocket.process)
     th.daemon = True
     th.start()
 
+    if args.telemetry_port:
+        tmsocket = TelemetrySocket(device_ip, server, args.telemetry_port, args.verbose)
+        tmth = threading.Thread(target=tmsocket.process)
+        tmth.daemon = True
+        tmth.start()
+
     server.run_forever()
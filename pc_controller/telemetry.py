@@ -0,0 +1,100 @@
+# Decoder of the robot's binary telemetry, see src/telemetry.hpp for the wire format.
+# Works with both python 2 and 3.
+import struct
+
+MAGIC = 0x4D54
+VERSION = 1
+UDP_PORT = 42425
+
+ODOMETRY = 1
+BLOCKS = 2
+TRACE = 3
+
+DATAGRAM_HEADER = struct.Struct("<HBBI")
+RECORD_HEADER = struct.Struct("<BBI")
+ODOMETRY_RECORD = struct.Struct("<iiIiii")
+BLOCKS_RECORD = struct.Struct("<I")
+COLOR_BLOCK = struct.Struct("<HHHHHhBB")
+TRACE_RECORD = struct.Struct("<IIBBH")
+
+ANGLE32_TO_RAD = 3.141592653589793 / 2**31
+
+class DecodeError(Exception):
+    pass
+
+def _items(st, payload, offset):
+    count = (len(payload) - offset) // st.size
+    return [ st.unpack_from(payload, offset + i*st.size) for i in range(count) ]
+
+def _odometry(payload):
+    x, y, heading, left, right, yaw = ODOMETRY_RECORD.unpack_from(payload)
+    if heading >= 2**31:
+        heading -= 2**32
+    return {
+        "x": x / 1000.0, "y": y / 1000.0, "heading": heading * ANGLE32_TO_RAD,
+        "vl": left / 1000.0, "vr": right / 1000.0, "yaw": yaw / 1000.0,
+    }
+
+def _blocks(payload):
+    frame, = BLOCKS_RECORD.unpack_from(payload)
+    blocks = [ { "sig": b[0], "x": b[1], "y": b[2], "w": b[3], "h": b[4], "angle": b[5], "index": b[6], "age": b[7] }
+        for b in _items(COLOR_BLOCK, payload, BLOCKS_RECORD.size) ]
+    return { "frame": frame, "blocks": blocks }
+
+def _trace(payload):
+    return { "events": [ { "cycles": r[0], "arg": r[1], "event": r[2], "core": r[3], "seq": r[4] }
+        for r in _items(TRACE_RECORD, payload, 0) ] }
+
+DECODERS = {
+    ODOMETRY: ("odometry", _odometry),
+    BLOCKS: ("blocks", _blocks),
+    TRACE: ("trace", _trace),
+}
+
+def decode(data):
+    """ Returns (seq, records), each record is a dict with at least "type" and "t" (robot time in us). """
+    if len(data) < DATAGRAM_HEADER.size:
+        raise DecodeError("datagram too short: %d bytes" % len(data))
+    magic, version, count, seq = DATAGRAM_HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise DecodeError("not a telemetry datagram, magic %04x version %d" % (magic, version))
+
+    records = []
+    offset = DATAGRAM_HEADER.size
+    for i in range(count):
+        if offset + RECORD_HEADER.size > len(data):
+            raise DecodeError("record %d is cut off" % i)
+        rtype, length, t = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        payload = data[offset:offset + length]
+        offset += length
+        if len(payload) != length:
+            raise DecodeError("record %d is cut off" % i)
+
+        name, fn = DECODERS.get(rtype, (None, None))
+        if fn is None:
+            rec = { "type": rtype, "raw": list(bytearray(payload)) }
+        else:
+            rec = fn(payload)
+            rec["type"] = name
+        rec["t"] = t
+        records.append(rec)
+    return seq, records
+
+class Receiver:
+    """ Tracks the datagram sequence numbers to count the lost ones. """
+    def __init__(self):
+        self.last_seq = None
+        self.received = 0
+        self.lost = 0
+
+    def decode(self, data):
+        seq, records = decode(data)
+        if self.last_seq is not None:
+            gap = (seq - self.last_seq - 1) & 0xFFFFFFFF
+            # a big jump back means the robot restarted
+            if gap < 0x80000000:
+                self.lost += gap
+        self.last_seq = seq
+        self.received += 1
+        return seq, records
@@ -0,0 +1,71 @@
+# Embeds the gzipped web UI from data/ into the firmware, as const arrays which stay in flash,
+# with an ETag for each file. Generates src/web_assets.gen.cpp, used by src/web_ui.cpp.
+#
+# Runs before every build as a PlatformIO extra_script, or by hand:
+#     python scripts/embed_web_assets.py
+import hashlib
+import os
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+}
+
+def generate(project_dir):
+    data_dir = os.path.join(project_dir, "data")
+    out_path = os.path.join(project_dir, "src", "web_assets.gen.cpp")
+
+    names = sorted(n for n in os.listdir(data_dir) if n.endswith(".gz"))
+
+    out = [
+        "// Generated by scripts/embed_web_assets.py from data/*.gz, do not edit.",
+        "#include \"web_ui.hpp\"",
+        "",
+        "namespace web {",
+        "",
+    ]
+    assets = []
+    for i, name in enumerate(names):
+        with open(os.path.join(data_dir, name), "rb") as f:
+            content = bytearray(f.read())
+        path = "/" + name[:-3]
+        ctype = CONTENT_TYPES.get(os.path.splitext(path)[1], "application/octet-stream")
+        etag = hashlib.sha1(content).hexdigest()[:16]
+
+        out.append("static const uint8_t asset%d[%d] = {" % (i, len(content)))
+        for off in range(0, len(content), 20):
+            out.append("    " + ", ".join("0x%02x" % b for b in content[off:off+20]) + ",")
+        out.append("};")
+        out.append("")
+        assets.append('    { "%s", "%s", "\\"%s\\"", asset%d, sizeof(asset%d) },' % (path, ctype, etag, i, i))
+
+    out.append("const Asset ASSETS[] = {")
+    out.extend(assets)
+    out.append("};")
+    out.append("const size_t ASSET_COUNT = %d;" % len(names))
+    out.append("")
+    out.append("};")
+    out.append("")
+    text = "\n".join(out)
+
+    # leave it alone if nothing changed, so it does not get rebuilt every time
+    try:
+        with open(out_path, "r") as f:
+            if f.read() == text:
+                return
+    except IOError:
+        pass
+    with open(out_path, "w") as f:
+        f.write(text)
+    print("Embedded %d web assets into %s" % (len(names), out_path))
+
+try:
+    Import("env")
+    generate(env["PROJECT_DIR"])
+except NameError:
+    generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
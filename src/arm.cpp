@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <esp_timer.h>
+#include <math.h>
+
+#include "arm.hpp"
+
+namespace control {
+
+ArmIk::ArmIk(const ArmGeometry& g) : m_len0(g.bones[0].lengthMm), m_len1(g.bones[1].lengthMm) {
+    for(size_t i = 0; i < 2; ++i) {
+        m_rel[i] = range(g.bones[i].relMin, g.bones[i].relMax);
+        m_abs[i] = range(g.bones[i].absMin, g.bones[i].absMax);
+    }
+    m_base1 = range(g.bones[1].baseMin, g.bones[1].baseMax);
+}
+
+esp_err_t ArmIk::solve(int32_t xMm, int32_t yMm, ArmJoints& out) const {
+    const int64_t d2 = int64_t(xMm) * xMm + int64_t(yMm) * yMm;
+    const int64_t l0 = m_len0;
+    const int64_t l1 = m_len1;
+    if(d2 > (l0 + l1) * (l0 + l1) || d2 < (l0 - l1) * (l0 - l1)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // law of cosines, the elbow angle between the bones, in Q15
+    const int64_t c = std::max(int64_t(-32768), std::min(int64_t(32768), (d2 - l0 * l0 - l1 * l1) * 32768 / (2 * l0 * l1)));
+    const int64_t s = isqrt((int64_t(1) << 30) - c * c);
+    const Angle32 toTarget = atan2Angle32(yMm, xMm);
+
+    // elbow up first, it is the one which fits roboruka's limits
+    for(int sign = 1; sign >= -1; sign -= 2) {
+        ArmJoints j;
+        const int32_t elbowSin = sign * s;
+        j.a0 = toTarget - atan2Angle32(l1 * elbowSin, l0 * 32768 + l1 * c);
+        j.a1 = j.a0 + atan2Angle32(elbowSin, c);
+        if(withinLimits(j)) {
+            out = j;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void ArmIk::position(const ArmJoints& j, int32_t& xMm, int32_t& yMm) const {
+    xMm = (m_len0 * cosQ15(j.a0) + m_len1 * cosQ15(j.a1)) >> 15;
+    yMm = (m_len0 * sinQ15(j.a0) + m_len1 * sinQ15(j.a1)) >> 15;
+}
+
+bool ArmIk::withinLimits(const ArmJoints& j) const {
+    const Angle32 elbow = j.a1 - j.a0;
+    return m_rel[0].contains(j.a0) && m_abs[0].contains(j.a0)
+        && m_rel[1].contains(elbow) && m_abs[1].contains(j.a1) && m_base1.contains(elbow);
+}
+
+ArmTrajectory::ArmTrajectory(const ArmIk& ik, const ArmTrajectoryConfig& cfg, const ArmJoints& start)
+    : m_ik(ik), m_cfg(cfg), m_head(0), m_tail(0), m_clear(false), m_moving(false),
+      m_from(start), m_to(start), m_current(start), m_startUs(0), m_durationUs(0) {}
+
+esp_err_t ArmTrajectory::start(const LoopConfig& loop) {
+    if(m_cfg.write == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return std::get<1>(Runtime::get().add(loop, [this]() { update(); }));
+}
+
+esp_err_t ArmTrajectory::moveTo(int32_t xMm, int32_t yMm) {
+    ArmJoints j;
+    const auto err = m_ik.solve(xMm, yMm, j);
+    if(err != ESP_OK) {
+        return err;
+    }
+    return moveTo(j);
+}
+
+esp_err_t ArmTrajectory::moveTo(const ArmJoints& joints) {
+    const uint32_t head = m_head.load(std::memory_order_relaxed);
+    if(head - m_tail.load(std::memory_order_acquire) >= QUEUE_SIZE) {
+        return ESP_ERR_NO_MEM;
+    }
+    m_queue[head % QUEUE_SIZE] = joints;
+    m_head.store(head + 1, std::memory_order_release);
+    return ESP_OK;
+}
+
+void ArmTrajectory::clear() {
+    m_clear = true;
+}
+
+void ArmTrajectory::begin(const ArmJoints& target, int64_t nowUs) {
+    m_from = m_current;
+    m_to = target;
+    m_startUs = nowUs;
+
+    // a minimum-jerk move peaks at 1.875x its average speed
+    const float d0 = fabsf(angle32ToRad(m_to.a0 - m_from.a0));
+    const float d1 = fabsf(angle32ToRad(m_to.a1 - m_from.a1));
+    const float seconds = 1.875f * std::max(d0, d1) / m_cfg.maxSpeed;
+    m_durationUs = std::max(int64_t(m_cfg.minDurationMs) * 1000, int64_t(seconds * 1e6f));
+    m_moving = true;
+}
+
+void ArmTrajectory::update() {
+    const int64_t now = esp_timer_get_time();
+
+    if(m_clear) {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+        m_clear = false;
+    }
+
+    if(!m_moving) {
+        const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail == m_head.load(std::memory_order_acquire)) {
+            return;
+        }
+        // m_moving is set before the point leaves the queue, so idle() is never true in between
+        begin(m_queue[tail % QUEUE_SIZE], now);
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+
+    // s = 10t^3 - 15t^4 + 6t^5, everything in Q15
+    const int64_t t = std::min(int64_t(32768), (now - m_startUs) * 32768 / m_durationUs);
+    const int64_t t2 = (t * t) >> 15;
+    const int64_t t3 = (t2 * t) >> 15;
+    const int64_t poly = 10 * 32768 - 15 * t + 6 * t2;
+    const int64_t s = (t3 * poly) >> 15;
+
+    m_current.a0 = m_from.a0 + Angle32((int64_t(int32_t(m_to.a0 - m_from.a0)) * s) >> 15);
+    m_current.a1 = m_from.a1 + Angle32((int64_t(int32_t(m_to.a1 - m_from.a1)) * s) >> 15);
+    if(t >= 32768) {
+        m_current = m_to;
+        m_moving = false;
+    }
+
+    m_cfg.write(m_current, m_cfg.writeCtx);
+}
+
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+// Two-bone arm: fixed-point inverse kinematics within the joint limits from layout.h,
+// and a trajectory generator streaming minimum-jerk joint setpoints at the servo bus rate.
+//
+// Same coordinates as rkArmMoveTo: millimetres from the shoulder joint, x forward, y down.
+// Angles are absolute, 0 is forward, positive turns down (towards +y).
+
+#include <atomic>
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "fixed_math.hpp"
+
+namespace control {
+
+struct ArmBone {
+    int32_t lengthMm;
+
+    // Limits in radians, the same as in layout.h / rkArmGetInfo(): relative to the previous
+    // bone (the base for the first one), absolute, and relative to the first bone.
+    float relMin, relMax;
+    float absMin, absMax;
+    float baseMin, baseMax;
+};
+
+struct ArmGeometry {
+    ArmBone bones[2];
+
+    // Roboruka's arm, as in layout.h
+    static ArmGeometry roboruka() {
+        ArmGeometry g;
+        g.bones[0] = ArmBone { 110, -1.65806f, 0.f, -3.14159f, 3.14159f, -3.14159f, 3.14159f };
+        g.bones[1] = ArmBone { 130, 0.523599f, 2.96706f, -0.349066f, 3.14159f, 0.698132f, 2.79253f };
+        return g;
+    }
+};
+
+struct ArmJoints {
+    Angle32 a0;
+    Angle32 a1;
+};
+
+class ArmIk {
+public:
+    ArmIk(const ArmGeometry& geometry = ArmGeometry::roboruka());
+
+    // ESP_ERR_INVALID_ARG if x, y is out of reach, ESP_ERR_NOT_FOUND if neither
+    // elbow position fits the limits.
+    esp_err_t solve(int32_t xMm, int32_t yMm, ArmJoints& out) const;
+
+    // Forward kinematics, where the end of the arm is.
+    void position(const ArmJoints& joints, int32_t& xMm, int32_t& yMm) const;
+
+    bool withinLimits(const ArmJoints& joints) const;
+
+private:
+    struct Range {
+        int32_t min;
+        int32_t max;
+
+        bool contains(Angle32 a) const { return int32_t(a) >= min && int32_t(a) <= max; }
+    };
+
+    static Range range(float min, float max) { return Range { int32_t(radToAngle32(min)), int32_t(radToAngle32(max)) }; }
+
+    int32_t m_len0;
+    int32_t m_len1;
+    Range m_rel[2];
+    Range m_abs[2];
+    Range m_base1;
+};
+
+// Receives the joint setpoints, e.g. to convert them to servo angles and send them to the bus.
+typedef void (*JointWriter)(const ArmJoints& joints, void *ctx);
+
+struct ArmTrajectoryConfig {
+    JointWriter write = nullptr;
+    void *writeCtx = nullptr;
+
+    // Peak joint speed, rad/s. Moves are stretched so the faster joint stays below it.
+    float maxSpeed = 3.f;
+    uint32_t minDurationMs = 80;
+};
+
+// Moves are queued and run one after another. Each one is a minimum-jerk profile in joint
+// space, both joints start and stop together, with zero speed and acceleration at both ends,
+// so nothing overshoots.
+class ArmTrajectory {
+public:
+    static constexpr const size_t QUEUE_SIZE = 8;
+
+    // start is where the arm is now.
+    ArmTrajectory(const ArmIk& ik, const ArmTrajectoryConfig& cfg, const ArmJoints& start);
+
+    // Registers update() with the control::Runtime, its period is the setpoint rate.
+    esp_err_t start(const LoopConfig& loop);
+
+    // One setpoint, called by the loop. Only ever from one task.
+    void update();
+
+    // Queue a move, from one task at a time. ESP_ERR_NO_MEM if the queue is full,
+    // otherwise the result of ArmIk::solve.
+    esp_err_t moveTo(int32_t xMm, int32_t yMm);
+    esp_err_t moveTo(const ArmJoints& joints);
+
+    // Drops the queued moves, the current one is finished.
+    void clear();
+
+    bool idle() const { return !m_moving && m_head == m_tail; }
+
+private:
+    ArmTrajectory(const ArmTrajectory&) = delete;
+
+    void begin(const ArmJoints& target, int64_t nowUs);
+
+    const ArmIk& m_ik;
+    ArmTrajectoryConfig m_cfg;
+
+    // single producer (moveTo), single consumer (update)
+    ArmJoints m_queue[QUEUE_SIZE];
+    std::atomic<uint32_t> m_head;
+    std::atomic<uint32_t> m_tail;
+    std::atomic<bool> m_clear;
+
+    // only touched by update()
+    std::atomic<bool> m_moving;
+    ArmJoints m_from;
+    ArmJoints m_to;
+    ArmJoints m_current;
+    int64_t m_startUs;
+    int64_t m_durationUs;
+};
+
+};
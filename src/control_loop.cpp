@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <esp_timer.h>
+#include <stdio.h>
+
+#include "control_loop.hpp"
+
+namespace control {
+
+Runtime& Runtime::get() {
+    static Runtime instance;
+    return instance;
+}
+
+std::tuple<size_t, esp_err_t> Runtime::add(const LoopConfig& cfg, std::function<void()> body) {
+    if(m_count == MAX_LOOPS) {
+        return std::make_tuple(0, ESP_ERR_NO_MEM);
+    }
+    if(cfg.period == 0 || !body) {
+        return std::make_tuple(0, ESP_ERR_INVALID_ARG);
+    }
+
+    Loop& l = m_loops[m_count];
+    l.cfg = cfg;
+    l.body = std::move(body);
+    l.idx = m_count;
+    reset(l);
+
+    if(xTaskCreatePinnedToCore(loopTask, cfg.name, cfg.stackSize, &l, cfg.priority, nullptr, cfg.core) != pdPASS) {
+        l.body = nullptr;
+        return std::make_tuple(0, ESP_ERR_NO_MEM);
+    }
+    return std::make_tuple(m_count++, ESP_OK);
+}
+
+LoopStats Runtime::stats(size_t idx) const {
+    const Loop& l = m_loops[idx];
+    LoopStats s;
+    s.runs = l.runs.load(std::memory_order_relaxed);
+    s.overruns = l.overruns.load(std::memory_order_relaxed);
+    s.lastJitterUs = l.lastJitterUs.load(std::memory_order_relaxed);
+    s.maxJitterUs = l.maxJitterUs.load(std::memory_order_relaxed);
+    s.meanJitterUs = s.runs == 0 ? 0 : l.jitterSumUs.load(std::memory_order_relaxed) / s.runs;
+    s.lastRunUs = l.lastRunUs.load(std::memory_order_relaxed);
+    s.maxRunUs = l.maxRunUs.load(std::memory_order_relaxed);
+    return s;
+}
+
+void Runtime::resetStats(size_t idx) {
+    m_loops[idx].resetRequested = true;
+}
+
+void Runtime::dumpStats(trace::Writer writer, void *ctx) const {
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%-10s %8s %8s %10s %10s %10s %10s\n",
+        "loop", "runs", "overrun", "jitter us", "max jit us", "run us", "max run us");
+    writer(line, len, ctx);
+
+    for(size_t i = 0; i < m_count; ++i) {
+        const auto s = stats(i);
+        len = snprintf(line, sizeof(line), "%-10s %8u %8u %10u %10u %10u %10u\n", m_loops[i].cfg.name,
+            s.runs, s.overruns, s.meanJitterUs, s.maxJitterUs, s.lastRunUs, s.maxRunUs);
+        writer(line, len, ctx);
+    }
+}
+
+void Runtime::reset(Loop& l) {
+    l.runs = 0;
+    l.overruns = 0;
+    l.lastJitterUs = 0;
+    l.maxJitterUs = 0;
+    l.jitterSumUs = 0;
+    l.lastRunUs = 0;
+    l.maxRunUs = 0;
+    l.resetRequested = false;
+}
+
+void Runtime::loopTask(void *loopVoid) {
+    Loop& l = *(Loop*)loopVoid;
+    const TickType_t period = l.cfg.period;
+    const int64_t periodUs = int64_t(period) * portTICK_PERIOD_MS * 1000;
+
+    // Jitter is measured from the first wake, the task itself starts at no particular point of a tick.
+    TickType_t lastWake = xTaskGetTickCount();
+    vTaskDelayUntil(&lastWake, period);
+    int64_t scheduledUs = esp_timer_get_time();
+    while(true) {
+        if(l.resetRequested) {
+            reset(l);
+        }
+
+        const int64_t start = esp_timer_get_time();
+        const uint32_t jitter = std::max(int64_t(0), start - scheduledUs);
+
+        l.body();
+
+        const uint32_t run = esp_timer_get_time() - start;
+        l.lastJitterUs.store(jitter, std::memory_order_relaxed);
+        l.maxJitterUs.store(std::max(jitter, l.maxJitterUs.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        l.jitterSumUs.fetch_add(jitter, std::memory_order_relaxed);
+        l.lastRunUs.store(run, std::memory_order_relaxed);
+        l.maxRunUs.store(std::max(run, l.maxRunUs.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        l.runs.fetch_add(1, std::memory_order_relaxed);
+
+        // Skip the periods which are already gone instead of running them back to back,
+        // vTaskDelayUntil would return right away for each of them.
+        const TickType_t behind = xTaskGetTickCount() - lastWake;
+        if(behind >= period) {
+            const TickType_t missed = behind / period;
+            l.overruns.fetch_add(missed, std::memory_order_relaxed);
+            TRACE(LOOP_OVERRUN, uint32_t(l.idx) << 16 | missed);
+            lastWake += missed * period;
+            scheduledUs += missed * periodUs;
+        }
+
+        vTaskDelayUntil(&lastWake, period);
+        scheduledUs += periodUs;
+    }
+}
+
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+// Fixed-rate periodic loops, each on its own pinned FreeRTOS task woken by vTaskDelayUntil,
+// with overrun and jitter statistics. E.g. motors at 1 kHz, vision at the camera rate, UI at 10 Hz.
+
+#include <atomic>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <functional>
+#include <stdint.h>
+#include <tuple>
+
+#include "trace.hpp"
+
+namespace control {
+
+struct LoopConfig {
+    const char *name = "loop";
+    // In ticks, so the fastest rate is the tick rate (1 kHz with the Arduino configuration).
+    TickType_t period = pdMS_TO_TICKS(10);
+
+    BaseType_t core = 1;
+    UBaseType_t priority = 5;
+    uint32_t stackSize = 4096;
+};
+
+struct LoopStats {
+    uint32_t runs = 0;
+    // Periods skipped because a run (or a higher priority task) took too long.
+    uint32_t overruns = 0;
+
+    // How late the runs started, against the ideal schedule.
+    uint32_t lastJitterUs = 0;
+    uint32_t maxJitterUs = 0;
+    uint32_t meanJitterUs = 0;
+
+    // How long the body took.
+    uint32_t lastRunUs = 0;
+    uint32_t maxRunUs = 0;
+};
+
+class Runtime {
+public:
+    static constexpr const size_t MAX_LOOPS = 8;
+
+    static Runtime& get();
+
+    // Starts body running every cfg.period. Call it from setup, not from the loops.
+    // Returns the loop index for stats().
+    std::tuple<size_t, esp_err_t> add(const LoopConfig& cfg, std::function<void()> body);
+
+    size_t size() const { return m_count; }
+    const LoopConfig& config(size_t idx) const { return m_loops[idx].cfg; }
+
+    // Snapshot of the counters. They are updated while reading, so they may be a run apart.
+    LoopStats stats(size_t idx) const;
+    // Done by the loop itself before its next run.
+    void resetStats(size_t idx);
+
+    // Text table with the stats of all loops.
+    void dumpStats(trace::Writer writer, void *ctx) const;
+
+private:
+    struct Loop {
+        LoopConfig cfg;
+        std::function<void()> body;
+        size_t idx;
+
+        std::atomic<uint32_t> runs;
+        std::atomic<uint32_t> overruns;
+        std::atomic<uint32_t> lastJitterUs;
+        std::atomic<uint32_t> maxJitterUs;
+        std::atomic<uint32_t> jitterSumUs;
+        std::atomic<uint32_t> lastRunUs;
+        std::atomic<uint32_t> maxRunUs;
+        std::atomic<bool> resetRequested;
+    };
+
+    Runtime() : m_count(0) {}
+    Runtime(const Runtime&) = delete;
+
+    static void loopTask(void *loopVoid);
+    static void reset(Loop& l);
+
+    Loop m_loops[MAX_LOOPS];
+    size_t m_count;
+};
+
+};
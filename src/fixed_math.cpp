@@ -0,0 +1,91 @@
+#include "fixed_math.hpp"
+
+namespace control {
+
+int32_t sinQ15(Angle32 a) {
+    // sin(pi/2 * x) ~ x * (A + x^2 * (B + x^2 * C)) on one quadrant, x in Q15,
+    // with the slope right at 0 and the peak at 1
+    static constexpr const int32_t A = 51472; // pi/2
+    static constexpr const int32_t B = -21023; // 1 - A - C
+    static constexpr const int32_t C = 2321; // A - 3/2
+
+    const uint32_t quadrant = a >> 30;
+    int32_t x = (a >> 15) & 0x7FFF;
+    if(quadrant & 1) {
+        x = 32768 - x;
+    }
+
+    const int32_t x2 = (x * x) >> 15;
+    int32_t t = B + ((C * x2) >> 15);
+    t = A + ((t * x2) >> 15);
+    const int32_t y = (t * x) >> 15;
+    return quadrant & 2 ? -y : y;
+}
+
+// atan(2^-i) as Angle32
+static const Angle32 ATAN_TABLE[] = {
+    0x20000000, 0x12e4051e, 0x9fb385b, 0x51111d4, 0x28b0d43, 0x145d7e1, 0xa2f61e, 0x517c55,
+    0x28be53, 0x145f2f, 0xa2f98, 0x517cc, 0x28be6, 0x145f3, 0xa2fa, 0x517d,
+    0x28be, 0x145f, 0xa30, 0x518, 0x28c, 0x146, 0xa3, 0x51,
+};
+
+Angle32 atan2Angle32(int32_t y, int32_t x) {
+    if(x == 0 && y == 0) {
+        return 0;
+    }
+
+    int64_t vx = x;
+    int64_t vy = y;
+    Angle32 angle = 0;
+
+    // CORDIC only converges in the right half plane
+    if(vx < 0) {
+        vx = -vx;
+        vy = -vy;
+        angle = ANGLE32_HALF_TURN;
+    }
+
+    // scale up small vectors, the shifts below would eat them
+    while(vx != 0 || vy != 0) {
+        if(vx > (int64_t(1) << 40) || vy > (int64_t(1) << 40) || vy < -(int64_t(1) << 40)) {
+            break;
+        }
+        vx <<= 1;
+        vy <<= 1;
+    }
+
+    for(size_t i = 0; i < sizeof(ATAN_TABLE) / sizeof(ATAN_TABLE[0]); ++i) {
+        const int64_t dx = vx >> i;
+        const int64_t dy = vy >> i;
+        if(vy > 0) {
+            vx += dy;
+            vy -= dx;
+            angle += ATAN_TABLE[i];
+        } else {
+            vx -= dy;
+            vy += dx;
+            angle -= ATAN_TABLE[i];
+        }
+    }
+    return angle;
+}
+
+uint32_t isqrt(uint64_t v) {
+    uint64_t res = 0;
+    uint64_t bit = uint64_t(1) << 62;
+    while(bit > v) {
+        bit >>= 2;
+    }
+    while(bit != 0) {
+        if(v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return res;
+}
+
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+// Fixed-point helpers shared by the odometry and the arm: binary angles, sin/cos, atan2, sqrt.
+
+#include <math.h>
+#include <stdint.h>
+
+namespace control {
+
+// Binary angle: the whole uint32_t range is one turn, counter-clockwise, wraps by itself.
+typedef uint32_t Angle32;
+
+static constexpr const Angle32 ANGLE32_HALF_TURN = 0x80000000;
+static constexpr const Angle32 ANGLE32_QUARTER_TURN = 0x40000000;
+
+inline float angle32ToRad(Angle32 a) {
+    return int32_t(a) * float(M_PI / 2147483648.0);
+}
+
+// rad in (-pi, pi]
+inline Angle32 radToAngle32(float rad) {
+    return Angle32(int32_t(rad * float(2147483648.0 / M_PI)));
+}
+
+// sin and cos in Q15 (32768 is 1.0), max error about 5e-4
+int32_t sinQ15(Angle32 a);
+inline int32_t cosQ15(Angle32 a) { return sinQ15(a + ANGLE32_QUARTER_TURN); }
+
+// CORDIC, error about 1e-6 turn. atan2(0, 0) is 0.
+Angle32 atan2Angle32(int32_t y, int32_t x);
+
+// floor(sqrt(v))
+uint32_t isqrt(uint64_t v);
+
+};
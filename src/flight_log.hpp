@@ -0,0 +1,63 @@
+#pragma once
+
+// Format of the flight recorder log (see flight_recorder.hpp), shared with the host replay
+// tool (bench/flight_replay.cpp). Little endian, packed.
+//
+// The log is a sequence of PAGE_SIZE pages, one flash sector each. A page is a PageHeader
+// followed by whole records, a record never crosses a page boundary. A page the recorder was
+// still filling when it stopped has used erased, its records end at the first erased type.
+// The flash partition is split into RUN_SLOTS slots, every boot records into the slot with
+// the oldest run.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace flight {
+
+static constexpr const uint32_t PAGE_MAGIC = 0x31524C46; // "FLR1"
+static constexpr const size_t PAGE_SIZE = 4096;
+static constexpr const size_t RUN_SLOTS = 4;
+static constexpr const uint16_t PAGE_USED_UNKNOWN = 0xFFFF;
+
+struct PageHeader {
+    uint32_t magic;
+    // increments with every boot, the runs can be told apart
+    uint16_t run;
+    // bytes used, including this header, PAGE_USED_UNKNOWN if the page was never finished
+    uint16_t used;
+    // page number within the run
+    uint32_t seq;
+} __attribute__((packed));
+
+enum RecordType : uint8_t {
+    PIXY_TRANSACTION = 1, // PixyTransaction, request bytes, response bytes
+    MOTORS = 2, // MotorsRecord
+};
+
+struct RecordHeader {
+    uint8_t type;
+    uint8_t reserved;
+    // of the payload, without this header
+    uint16_t length;
+    // low 32 bits of esp_timer_get_time()
+    uint32_t timeUs;
+} __attribute__((packed));
+
+// The response is the packet as the parser assembled it (header included, garbage before
+// the sync word dropped), possibly cut short if the transaction failed.
+struct PixyTransaction {
+    int32_t err;
+    uint32_t durationUs;
+    uint8_t requestLen;
+} __attribute__((packed));
+
+struct MotorsRecord {
+    int8_t left;
+    int8_t right;
+} __attribute__((packed));
+
+static_assert(sizeof(PageHeader) == 12, "PageHeader is stored raw, keep it packed");
+static_assert(sizeof(RecordHeader) == 8, "RecordHeader is stored raw, keep it packed");
+static_assert(sizeof(PixyTransaction) == 9, "PixyTransaction is stored raw, keep it packed");
+
+};
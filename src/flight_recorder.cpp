@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "flight_recorder.hpp"
+
+namespace flight {
+
+static const char *TAG = "flight";
+
+FlightRecorder::FlightRecorder(const FlightRecorderConfig& cfg)
+    : m_cfg(cfg), m_partition(nullptr), m_slotSize(0), m_slotOffset(0), m_filling(nullptr), m_seq(0), m_run(0),
+      m_pageDueUs(0), m_flashPages(0), m_partial(nullptr), m_partialIndex(0), m_partialWritten(0), m_written(0),
+      m_dropped(0), m_full(false) {
+    m_cfg.ramPages = std::max(uint8_t(2), std::min(m_cfg.ramPages, uint8_t(MAX_RAM_PAGES)));
+    m_ram.reset(new uint8_t[m_cfg.ramPages * PAGE_SIZE]);
+    m_pages.reset(new Page[m_cfg.ramPages]);
+    for(size_t i = 0; i < m_cfg.ramPages; ++i) {
+        m_pages[i].data = m_ram.get() + i * PAGE_SIZE;
+        m_pages[i].state = FREE;
+    }
+}
+
+FlightRecorder::~FlightRecorder() {}
+
+esp_err_t FlightRecorder::begin() {
+    m_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, esp_partition_subtype_t(FLIGHTLOG_SUBTYPE), m_cfg.partition);
+    if(m_partition == nullptr) {
+        ESP_LOGE(TAG, "partition %s not found, nothing will be stored", m_cfg.partition);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // whole 64 KB blocks, the flash erases those much faster than sector by sector
+    m_slotSize = (m_partition->size / RUN_SLOTS) & ~(ERASE_BLOCK_SIZE - 1);
+    if(m_slotSize == 0 || (m_partition->address & (ERASE_BLOCK_SIZE - 1)) != 0) {
+        ESP_LOGW(TAG, "partition %s is not aligned to 64 KB, erasing will be slow", m_cfg.partition);
+        m_slotSize = (m_partition->size / RUN_SLOTS) & ~(PAGE_SIZE - 1);
+    }
+
+    // an empty slot, otherwise the one with the oldest run
+    size_t emptySlot = RUN_SLOTS;
+    size_t oldestSlot = 0;
+    bool haveRun = false;
+    uint16_t newest = 0;
+    uint16_t oldest = 0;
+    for(size_t i = 0; i < RUN_SLOTS; ++i) {
+        PageHeader h;
+        if(esp_partition_read(m_partition, i * m_slotSize, &h, sizeof(h)) != ESP_OK || h.magic != PAGE_MAGIC) {
+            emptySlot = std::min(emptySlot, i);
+            continue;
+        }
+        if(!haveRun || int16_t(h.run - newest) > 0) {
+            newest = h.run;
+        }
+        if(!haveRun || int16_t(h.run - oldest) < 0) {
+            oldest = h.run;
+            oldestSlot = i;
+        }
+        haveRun = true;
+    }
+    const size_t slot = emptySlot < RUN_SLOTS ? emptySlot : oldestSlot;
+    m_run = haveRun ? newest + 1 : 0;
+    m_slotOffset = slot * m_slotSize;
+
+    auto err = esp_partition_erase_range(m_partition, m_slotOffset, m_slotSize);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to erase the slot at %u: %d", m_slotOffset, err);
+        m_partition = nullptr;
+        return err;
+    }
+    ESP_LOGI(TAG, "recording run %u into slot %u", m_run, slot);
+    return ESP_OK;
+}
+
+esp_err_t FlightRecorder::start(const control::LoopConfig& loop) {
+    return std::get<1>(control::Runtime::get().add(loop, [this]() { flush(); }));
+}
+
+void FlightRecorder::finishLocked(Page& page) {
+    page.state = READY;
+    if(m_filling == &page) {
+        m_filling = nullptr;
+    }
+}
+
+uint8_t *FlightRecorder::beginRecordLocked(RecordType type, size_t len) {
+    const size_t size = sizeof(RecordHeader) + len;
+    if(m_filling != nullptr && ((PageHeader*)m_filling->data)->used + size > PAGE_SIZE) {
+        finishLocked(*m_filling);
+    }
+
+    if(m_filling == nullptr) {
+        for(size_t i = 0; i < m_cfg.ramPages; ++i) {
+            if(m_pages[i].state == FREE) {
+                m_filling = &m_pages[i];
+                break;
+            }
+        }
+        if(m_filling == nullptr) {
+            return nullptr;
+        }
+        m_filling->state = FILLING;
+
+        PageHeader h;
+        h.magic = PAGE_MAGIC;
+        h.run = m_run;
+        h.used = sizeof(PageHeader);
+        h.seq = m_seq++;
+        memcpy(m_filling->data, &h, sizeof(h));
+        m_pageDueUs = esp_timer_get_time() + int64_t(m_cfg.pageAgeMs) * 1000;
+    }
+
+    auto *page = (PageHeader*)m_filling->data;
+    uint8_t *dest = m_filling->data + page->used;
+    page->used += size;
+
+    RecordHeader r;
+    r.type = type;
+    r.reserved = 0;
+    r.length = len;
+    r.timeUs = esp_timer_get_time();
+    memcpy(dest, &r, sizeof(r));
+    return dest + sizeof(r);
+}
+
+void FlightRecorder::pixyHook(const uint8_t *request, size_t requestLen, const pixy2::PacketResponse& response, esp_err_t err, void *ctx) {
+    auto *self = (FlightRecorder*)ctx;
+    const size_t responseLen = response.rawSize();
+
+    std::lock_guard<std::mutex> l(self->m_mutex);
+    uint8_t *dest = self->beginRecordLocked(PIXY_TRANSACTION, sizeof(PixyTransaction) + requestLen + responseLen);
+    if(dest == nullptr) {
+        ++self->m_dropped;
+        return;
+    }
+
+    PixyTransaction t;
+    t.err = err;
+    t.durationUs = response.responseUs() - response.requestUs();
+    t.requestLen = requestLen;
+    memcpy(dest, &t, sizeof(t));
+    memcpy(dest + sizeof(t), request, requestLen);
+    memcpy(dest + sizeof(t) + requestLen, response.raw(), responseLen);
+}
+
+void FlightRecorder::recordMotors(int8_t left, int8_t right) {
+    std::lock_guard<std::mutex> l(m_mutex);
+    uint8_t *dest = beginRecordLocked(MOTORS, sizeof(MotorsRecord));
+    if(dest == nullptr) {
+        ++m_dropped;
+        return;
+    }
+    const MotorsRecord m = { left, right };
+    memcpy(dest, &m, sizeof(m));
+}
+
+void FlightRecorder::flush(bool force) {
+    Page *ready[MAX_RAM_PAGES];
+    size_t count = 0;
+    const Page *filling = nullptr;
+    size_t fillingUsed = 0;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if(force && m_filling != nullptr) {
+            finishLocked(*m_filling);
+        }
+        for(size_t i = 0; i < m_cfg.ramPages; ++i) {
+            if(m_pages[i].state == READY) {
+                m_pages[i].state = WRITING;
+                ready[count++] = &m_pages[i];
+            }
+        }
+        // the records below used are complete and nobody touches them anymore
+        const int64_t now = esp_timer_get_time();
+        if(m_filling != nullptr && now >= m_pageDueUs) {
+            filling = m_filling;
+            fillingUsed = ((const PageHeader*)filling->data)->used;
+            m_pageDueUs = now + int64_t(m_cfg.pageAgeMs) * 1000;
+        }
+    }
+
+    // in the order they were started
+    std::sort(ready, ready + count, [](const Page *a, const Page *b) {
+        return int32_t(((const PageHeader*)a->data)->seq - ((const PageHeader*)b->data)->seq) < 0;
+    });
+    for(size_t i = 0; i < count; ++i) {
+        writePage(*ready[i], ((const PageHeader*)ready[i]->data)->used, true);
+    }
+    if(filling != nullptr) {
+        writePage(*filling, fillingUsed, false);
+    }
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    for(size_t i = 0; i < count; ++i) {
+        ready[i]->state = FREE;
+    }
+}
+
+void FlightRecorder::writePage(const Page& page, size_t used, bool complete) {
+    if(m_partition == nullptr || m_full) {
+        return;
+    }
+
+    uint32_t index = m_partialIndex;
+    size_t from = m_partialWritten;
+    if(&page != m_partial) {
+        if((m_flashPages + 1) * PAGE_SIZE > m_slotSize) {
+            ESP_LOGW(TAG, "the slot is full, the rest of the run is not stored");
+            m_full = true;
+            return;
+        }
+        index = m_flashPages++;
+        from = 0;
+        ++m_written;
+    }
+
+    // Flash bits only go from 1 to 0, so an unfinished page goes out with used left erased
+    // and the rest is appended to it, used last. Exact lengths, the bytes past used must
+    // stay erased.
+    const size_t offset = m_slotOffset + index * PAGE_SIZE;
+    esp_err_t err = ESP_OK;
+    if(from == 0) {
+        PageHeader h;
+        memcpy(&h, page.data, sizeof(h));
+        if(!complete) {
+            h.used = PAGE_USED_UNKNOWN;
+        }
+        err = esp_partition_write(m_partition, offset, &h, sizeof(h));
+        from = sizeof(h);
+    }
+    if(err == ESP_OK && used > from) {
+        err = esp_partition_write(m_partition, offset + from, page.data + from, used - from);
+    }
+    if(err == ESP_OK && complete && &page == m_partial) {
+        err = esp_partition_write(m_partition, offset + offsetof(PageHeader, used), page.data + offsetof(PageHeader, used), sizeof(uint16_t));
+    }
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to write page %u: %d", index, err);
+    }
+
+    if(complete) {
+        if(&page == m_partial) {
+            m_partial = nullptr;
+        }
+    } else {
+        m_partial = &page;
+        m_partialIndex = index;
+        m_partialWritten = used;
+    }
+}
+
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+// Flight recorder: every Pixy2 transaction (raw request and response) and every motor command,
+// timestamped, appended to a preallocated RAM ring of pages and written out to the "flightlog"
+// flash partition in the background. Read the partition out after a match and run it through
+// bench/flight_replay.cpp. The format is in flight_log.hpp.
+//
+// The callers only copy into RAM and never wait for the flash. If the flash falls behind, new
+// records are dropped and counted. Writing flash stalls the CPU caches on both cores for the
+// length of each page program, well under a millisecond; the slow erase happens once, in begin().
+//
+//     pixy.setTransactionHook(flight::FlightRecorder::pixyHook, &recorder);
+
+#include <atomic>
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "flight_log.hpp"
+#include "pixy2/packet.hpp"
+
+namespace flight {
+
+static constexpr const uint8_t FLIGHTLOG_SUBTYPE = 0x40;
+// the flash's block erase, the partition should start on one
+static constexpr const size_t ERASE_BLOCK_SIZE = 0x10000;
+
+struct FlightRecorderConfig {
+    // data partition, subtype FLIGHTLOG_SUBTYPE, see partitions.csv
+    const char *partition = "flightlog";
+    // RAM ring, in PAGE_SIZE pages, at most FlightRecorder::MAX_RAM_PAGES
+    uint8_t ramPages = 4;
+    // the page being filled goes to flash at least this often, so a reset loses at most
+    // about this much of the log
+    uint32_t pageAgeMs = 1000;
+};
+
+class FlightRecorder {
+public:
+    static constexpr const size_t MAX_RAM_PAGES = 16;
+
+    FlightRecorder(const FlightRecorderConfig& cfg = FlightRecorderConfig());
+    ~FlightRecorder();
+
+    // Picks the slot with the oldest run and erases it, a few 64 KB blocks. Takes a few hundred ms
+    // with the caches stalled, call it during setup, before the control loops start.
+    esp_err_t begin();
+
+    // Registers flush() with the control::Runtime, give it a low priority.
+    esp_err_t start(const control::LoopConfig& loop);
+
+    // Writes the full pages to flash. The page being filled is finished if force is set,
+    // otherwise whatever it holds goes out once it is pageAgeMs old. Only ever from one task.
+    void flush(bool force = false);
+
+    // A pixy2::TransactionHook, ctx is the FlightRecorder.
+    static void pixyHook(const uint8_t *request, size_t requestLen, const pixy2::PacketResponse& response, esp_err_t err, void *ctx);
+
+    void recordMotors(int8_t left, int8_t right);
+
+    uint16_t run() const { return m_run; }
+    uint32_t written() const { return m_written; }
+    uint32_t dropped() const { return m_dropped; }
+    bool full() const { return m_full; }
+
+private:
+    FlightRecorder(const FlightRecorder&) = delete;
+
+    enum State : uint8_t { FREE, FILLING, READY, WRITING };
+
+    struct Page {
+        uint8_t *data;
+        State state;
+    };
+
+    // With m_mutex held. Starts a record and returns where its payload goes,
+    // nullptr if there is no room anywhere.
+    uint8_t *beginRecordLocked(RecordType type, size_t len);
+    void finishLocked(Page& page);
+    // From flush(). Writes page.data[0, used) out, only what is not in flash yet.
+    void writePage(const Page& page, size_t used, bool complete);
+
+    FlightRecorderConfig m_cfg;
+    const esp_partition_t *m_partition;
+    size_t m_slotSize;
+    size_t m_slotOffset;
+
+    std::unique_ptr<uint8_t[]> m_ram;
+    std::unique_ptr<Page[]> m_pages;
+
+    std::mutex m_mutex;
+    Page *m_filling;
+    uint32_t m_seq;
+    uint16_t m_run;
+    int64_t m_pageDueUs;
+
+    // only touched by flush()
+    uint32_t m_flashPages;
+    // the page being filled that is already partly in flash
+    const Page *m_partial;
+    uint32_t m_partialIndex;
+    size_t m_partialWritten;
+
+    std::atomic<uint32_t> m_written;
+    std::atomic<uint32_t> m_dropped;
+    std::atomic<bool> m_full;
+};
+
+};
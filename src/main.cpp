@@ -1,8 +1,45 @@
 #include <Arduino.h> // from Roboruka
 #include "RBControl.hpp" // for encoders 
 #include "roboruka.h"
+#include "control_loop.hpp"
+#include "flight_recorder.hpp"
+#include "odometry.hpp"
+#include "servo_manager.hpp"
+#include "telemetry.hpp"
+#include "velocity_controller.hpp"
+#include "web_ui.hpp"
+#include "trace.hpp"
 using namespace rb;
 
+static void readEncoders(int32_t& left, int32_t& right, void *ctx) {
+    auto &man = Manager::get();
+    left = man.motor(MotorId::M2).enc()->value();
+    right = man.motor(MotorId::M1).enc()->value();
+}
+
+// ctx je flight::FlightRecorder
+static void writeMotors(int8_t left, int8_t right, void *ctx) {
+    static int8_t lastLeft = 0, lastRight = 0;
+    rkMotorsSetPower(left, right);
+    if (left != lastLeft || right != lastRight) { // vola se 500x za sekundu
+        TRACE(MOTOR_POWER, uint32_t(uint16_t(left)) << 16 | uint16_t(right));
+        ((flight::FlightRecorder*)ctx)->recordMotors(left, right);
+        lastLeft = left;
+        lastRight = right;
+    }
+}
+
+// SmartServoBus::set jen zaradi pohyb do fronty sbernice, pos() ceka na odpoved serva
+static esp_err_t writeServo(uint8_t id, float deg, void *ctx) {
+    Manager::get().servoBus().set(id, Angle::deg(deg));
+    return ESP_OK;
+}
+
+static esp_err_t readServo(uint8_t id, float& deg, void *ctx) {
+    deg = Manager::get().servoBus().pos(id).deg();
+    return ESP_OK;
+}
+
 void setup() {
     rkConfig cfg;
     cfg.motor_enable_failsafe = false;
@@ -18,52 +55,149 @@ void setup() {
     fmt::print("{}'s roboruka '{}' started!\n", cfg.owner, cfg.name);
     fmt::print("Battery at {}%, {}mV\n", rkBatteryPercent(), rkBatteryVoltageMv());
 
-    rkMotorsSetPower(50, 50);
-    man.motor(MotorId::M1).drive(-500*110/100, 50);	// right motor 
-    man.motor(MotorId::M2).drive(-500, 50);	// left motor
-    delay(100);
-    //man.motor(MotorId::M1).drive(0, 0);	// nezastavi, dokud nedojede minuly drive  
-    //man.motor(MotorId::M2).drive(0, 0);
-    rkMotorsSetPower(0, 0); // zastavi ihned, i kdyz probiha drive  	
+    // ovladaci stranka primo z flash (data/*.gz); RBControl s rbcontroller_app_enable dal pripojuje
+    // SPIFFS a obsluhuje port 80, bez nej by nebezel protokol aplikace
+    static web::WebUi webUi;
+    webUi.start(8080);
+
+    // zaznam prubehu jizdy do oddilu flightlog, precte se po zapase (bench/README.md);
+    // begin() maze flash, musi probehnout pred spustenim regulace
+    static flight::FlightRecorder recorder;
+    recorder.begin();
+    control::LoopConfig recorderLoop;
+    recorderLoop.name = "recorder";
+    recorderLoop.period = pdMS_TO_TICKS(50);
+    recorderLoop.core = 0;
+    recorderLoop.priority = 1;
+    recorder.start(recorderLoop);
+    // pixy.setTransactionHook(flight::FlightRecorder::pixyHook, &recorder); // az bude kamera zapojena
+
+    // odometrie, 1 kHz; rozmery zmerene na robotu se zadavaji v platformio.ini, bez nich nebezi
+    control::OdometryConfig odomCfg;
+    odomCfg.read = readEncoders;
+#if defined(ODOM_NM_PER_TICK) && defined(ODOM_WHEEL_BASE_UM)
+    odomCfg.nmPerTick = ODOM_NM_PER_TICK;
+    odomCfg.wheelBaseUm = ODOM_WHEEL_BASE_UM;
+#endif
+    static control::Odometry odometry(odomCfg);
+    control::LoopConfig odomLoop;
+    odomLoop.name = "odom";
+    odomLoop.period = 1;
+    odomLoop.priority = 10;
+    const bool odomRunning = odometry.start(odomLoop) == ESP_OK;
+    if (!odomRunning) {
+        fmt::print("odometry off, set ODOM_NM_PER_TICK and ODOM_WHEEL_BASE_UM in platformio.ini\n");
+    }
+
+    // regulace rychlosti kol, misto pevne korekce praveho motoru o 110 %
+    control::VelocityControllerConfig velCfg;
+    velCfg.write = writeMotors;
+    velCfg.writeCtx = &recorder;
+    static control::VelocityController velocity(velCfg, odometry);
+    control::LoopConfig velLoop;
+    velLoop.name = "velocity";
+    velLoop.period = 2;
+    velLoop.priority = 9;
+    if (odomRunning) { // bez odometrie by regulator videl stale nulovou rychlost
+        velocity.start(velLoop);
+    }
+
+    // uvodni popojeti dozadu; motory vyvazuje regulator, bez odometrie prosty symetricky pohyb
+    if (odomRunning) {
+        velocity.setVelocity(-200, -200); // mm/s
+        delay(100);
+        velocity.stop(); // brzdi s maxDecel
+        delay(200);
+    } else {
+        rkMotorsSetPower(50, 50);
+        man.motor(MotorId::M1).drive(-500, 50);	// right motor 
+        man.motor(MotorId::M2).drive(-500, 50);	// left motor
+        delay(100);
+        rkMotorsSetPower(0, 0); // zastavi ihned, i kdyz probiha drive  	
+    }
     int32_t enR = man.motor(MotorId::M1).enc()->value();  // reading encoder
     int32_t enL = man.motor(MotorId::M2).enc()->value();
     fmt::print("enc: {},  {}\n",  enL, enR);
 
+    // binarni telemetrie pro pc_controller: odometrie 100 Hz, odesila se po 5 vzorcich v jednom datagramu
+    static telemetry::UdpLink telemetryLink;
+    telemetryLink.open();
+    telemetry::ChannelConfig tmCfg;
+    tmCfg.send = telemetry::UdpLink::send;
+    tmCfg.sendCtx = &telemetryLink;
+    static telemetry::Channel tm(tmCfg);
+    control::LoopConfig tmLoop;
+    tmLoop.name = "telemetry";
+    tmLoop.period = pdMS_TO_TICKS(10);
+    tmLoop.priority = 3;
+    if (odomRunning) { // jinak by na pc chodily nulove polohy, ktere vypadaji jako skutecne
+        control::Runtime::get().add(tmLoop, []() {
+            static uint32_t iteration = 0;
+            tm.pushOdometry(odometry.snapshot());
+            if (++iteration % 5 == 0) {
+                tm.flush();
+            }
+        });
+    }
+
+    // serva na sbernici, 50 Hz: vsechna nastavena serva najednou, pak cteni polohy jednoho z nich
+    control::ServoBusOps servoOps;
+    servoOps.write = writeServo;
+    servoOps.read = readServo;
+    static control::ServoManager servos(servoOps, 2);
+    control::LoopConfig servoLoop;
+    servoLoop.name = "servos";
+    servoLoop.period = pdMS_TO_TICKS(20);
+    servoLoop.priority = 5;
+    servos.start(servoLoop);
 
     // rkArmSetServo(3, 60); // parkovaci pozice 
-    int k = 80; 
-    int IDservo0 = 0;
-    int IDservo1 = 1;
+    static int k = 80; 
+    static const uint8_t IDservo0 = 0;
+    static const uint8_t IDservo1 = 1;
+
+    // UI: tlacitka a vypis, 10 Hz
+    control::LoopConfig uiCfg;
+    uiCfg.name = "ui";
+    uiCfg.period = pdMS_TO_TICKS(100);
+    uiCfg.priority = 2;
+    control::Runtime::get().add(uiCfg, []() {
+        static uint32_t iteration = 0;
+        TRACE(LOOP_ITERATION, iteration);
+#ifdef ROBOT_TRACE
+        const uint32_t loopStart = trace::now();
+#endif
 
-    while(true) {     
-   
-        
         // zacatek nastavovani serv ****************************************************************************************
         if (rkButtonIsPressed(1, true)) {
             k += 10;
-            rkArmSetServo(IDservo0, k);
-            rkArmSetServo(IDservo1, k);
+            servos.set({ { IDservo0, float(k) }, { IDservo1, float(k) } }); // obe serva ve stejnem pruchodu
         }
         if (rkButtonIsPressed(2, true)) { 
             k-=10;
-            rkArmSetServo(IDservo0, k);
-            rkArmSetServo(IDservo1, k);      
+            servos.set({ { IDservo0, float(k) }, { IDservo1, float(k) } }); // obe serva ve stejnem pruchodu
         }
         if (rkButtonIsPressed(3, true)) {
             k += 1;
-            rkArmSetServo(IDservo0, k);
-            rkArmSetServo(IDservo1, k);
+            servos.set({ { IDservo0, float(k) }, { IDservo1, float(k) } }); // obe serva ve stejnem pruchodu
         }
-    
-
-
 
+        // polohy z cache, sbernici necte (driv rkArmGetServo) //konec nastavovani serv *****************
+        if (iteration % 5 == 0) {
+            printf("vision: %i, position: %3.2f, %3.2f  \n", k, servos.position(IDservo0).deg, servos.position(IDservo1).deg);
+        }
+#ifdef ROBOT_TRACE
+        trace::latency(trace::HIST_LOOP, loopStart);
+        if (iteration % 100 == 0) {
+            trace::dumpHistograms(trace::serialWriter, nullptr);
+            control::Runtime::get().dumpStats(trace::serialWriter, nullptr);
+        }
+#endif
+        ++iteration;
+    });
 
-        //printf("vision: %i, position: %3.2f, %3.2f  \n", k, rkArmGetServo(IDservo0), rkArmGetServo(IDservo1) ); //konec nastavovani serv *****************
-        printf("vision: %i, position: \n", k);
-        delay(500);
-        //vTaskDelay(pdMS_TO_TICKS(500));  
-    }
+    // vse dalsi bezi v control::Runtime
+    vTaskDelete(nullptr);
 }
 
 
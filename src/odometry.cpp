@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <esp_timer.h>
+
+#include "odometry.hpp"
+
+namespace control {
+
+Odometry::Odometry(const OdometryConfig& cfg)
+    : m_cfg(cfg), m_first(true), m_lastLeft(0), m_lastRight(0), m_xNm(0), m_yNm(0), m_heading(0),
+      m_historyPos(0), m_historyCount(0), m_resetRequested(false), m_resetX(0), m_resetY(0), m_resetHeading(0) {
+    m_cfg.velocityWindow = std::max(uint8_t(2), std::min(m_cfg.velocityWindow, uint8_t(MAX_VELOCITY_WINDOW)));
+    m_angleScale = m_cfg.wheelBaseUm > 0 ? int64_t((4294967296.0 / (2 * M_PI)) / (m_cfg.wheelBaseUm * 1000.0) * 4294967296.0) : 0;
+}
+
+esp_err_t Odometry::start(const LoopConfig& loop) {
+    if(m_cfg.read == nullptr || m_cfg.nmPerTick == 0 || m_cfg.wheelBaseUm <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return std::get<1>(Runtime::get().add(loop, [this]() { update(); }));
+}
+
+void Odometry::reset(int32_t xUm, int32_t yUm, Angle32 heading) {
+    m_resetX = xUm;
+    m_resetY = yUm;
+    m_resetHeading = heading;
+    m_resetRequested = true;
+}
+
+void Odometry::update() {
+    int32_t left, right;
+    m_cfg.read(left, right, m_cfg.readCtx);
+    const int64_t now = esp_timer_get_time();
+
+    if(m_first) {
+        m_lastLeft = left;
+        m_lastRight = right;
+        m_first = false;
+    }
+    if(m_resetRequested) {
+        m_xNm = int64_t(m_resetX) * 1000;
+        m_yNm = int64_t(m_resetY) * 1000;
+        m_heading = m_resetHeading;
+        m_resetRequested = false;
+    }
+
+    const int64_t dl = int64_t(left - m_lastLeft) * m_cfg.nmPerTick;
+    const int64_t dr = int64_t(right - m_lastRight) * m_cfg.nmPerTick;
+    m_lastLeft = left;
+    m_lastRight = right;
+
+    // Move along the heading halfway through the turn, exact for arcs up to the second order.
+    const Angle32 turn = Angle32((((dr - dl) * m_angleScale) >> 32));
+    const Angle32 mid = m_heading + Angle32(int32_t(turn) / 2);
+    const int64_t forward = (dl + dr) / 2;
+    m_xNm += (forward * cosQ15(mid)) >> 15;
+    m_yNm += (forward * sinQ15(mid)) >> 15;
+    m_heading += turn;
+
+    // velocities from the oldest sample still in the window
+    m_history[m_historyPos] = Sample { now, left, right };
+    m_historyPos = (m_historyPos + 1) % m_cfg.velocityWindow;
+    m_historyCount = std::min(m_historyCount + 1, size_t(m_cfg.velocityWindow));
+    const Sample& oldest = m_history[m_historyCount < m_cfg.velocityWindow ? 0 : m_historyPos];
+
+    OdometrySnapshot s;
+    s.timestampUs = now;
+    s.xUm = m_xNm / 1000;
+    s.yUm = m_yNm / 1000;
+    s.heading = m_heading;
+    s.leftTicks = left;
+    s.rightTicks = right;
+
+    const int64_t dt = now - oldest.us;
+    if(dt > 0) {
+        // nm per us is mm per s, scale to um per s
+        s.leftUmPerS = int64_t(left - oldest.left) * m_cfg.nmPerTick * 1000 / dt;
+        s.rightUmPerS = int64_t(right - oldest.right) * m_cfg.nmPerTick * 1000 / dt;
+    } else {
+        s.leftUmPerS = 0;
+        s.rightUmPerS = 0;
+    }
+    s.forwardUmPerS = (int64_t(s.leftUmPerS) + s.rightUmPerS) / 2;
+    s.yawMradPerS = (int64_t(s.rightUmPerS) - s.leftUmPerS) * 1000 / m_cfg.wheelBaseUm;
+
+    m_published.write(s);
+}
+
+};
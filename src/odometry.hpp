@@ -0,0 +1,101 @@
+#pragma once
+
+// Differential-drive odometry: samples both encoders at a fixed rate on a control::Runtime loop,
+// integrates the pose in fixed point and publishes it, with velocities, through a SeqLock.
+
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "fixed_math.hpp"
+#include "seqlock.hpp"
+
+namespace control {
+
+// Reads the current encoder counts, forward is positive on both wheels.
+typedef void (*EncoderReader)(int32_t& left, int32_t& right, void *ctx);
+
+struct OdometryConfig {
+    EncoderReader read = nullptr;
+    void *readCtx = nullptr;
+
+    // distance travelled per encoder tick, in nanometres
+    int32_t nmPerTick = 0;
+    // distance between the wheel contact points, in micrometres
+    int32_t wheelBaseUm = 0;
+
+    // velocities are averaged over this many samples, at most MAX_VELOCITY_WINDOW
+    uint8_t velocityWindow = 8;
+};
+
+struct OdometrySnapshot {
+    int64_t timestampUs;
+
+    // from where the odometry started or was last reset, x is the initial forward direction
+    int32_t xUm;
+    int32_t yUm;
+    Angle32 heading;
+
+    int32_t leftTicks;
+    int32_t rightTicks;
+
+    int32_t leftUmPerS;
+    int32_t rightUmPerS;
+    int32_t forwardUmPerS;
+    int32_t yawMradPerS;
+
+    float xMm() const { return xUm / 1000.f; }
+    float yMm() const { return yUm / 1000.f; }
+    float headingRad() const { return angle32ToRad(heading); }
+};
+
+class Odometry {
+public:
+    static constexpr const size_t MAX_VELOCITY_WINDOW = 32;
+
+    Odometry(const OdometryConfig& cfg);
+
+    // Registers update() with the control::Runtime.
+    esp_err_t start(const LoopConfig& loop);
+
+    // One sample, called by the loop. Only ever from one task.
+    void update();
+
+    // Sets the pose on the next update, e.g. to re-zero on a known spot.
+    void reset(int32_t xUm = 0, int32_t yUm = 0, Angle32 heading = 0);
+
+    // Lock-free, from any task.
+    OdometrySnapshot snapshot() const { return m_published.read(); }
+
+private:
+    Odometry(const Odometry&) = delete;
+
+    OdometryConfig m_cfg;
+    SeqLock<OdometrySnapshot> m_published;
+
+    // only touched by update()
+    bool m_first;
+    int32_t m_lastLeft;
+    int32_t m_lastRight;
+    int64_t m_xNm;
+    int64_t m_yNm;
+    Angle32 m_heading;
+    // 2^32 / (2 pi wheel base), the turn per nanometre of wheel difference in Q32
+    int64_t m_angleScale;
+
+    struct Sample {
+        int64_t us;
+        int32_t left;
+        int32_t right;
+    };
+    Sample m_history[MAX_VELOCITY_WINDOW];
+    size_t m_historyPos;
+    size_t m_historyCount;
+
+    std::atomic<bool> m_resetRequested;
+    int32_t m_resetX;
+    int32_t m_resetY;
+    Angle32 m_resetHeading;
+};
+
+};
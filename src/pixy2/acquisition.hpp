@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+
+#include "frame_scheduler.hpp"
+#include "pixy2.hpp"
+#include "triple_buffer.hpp"
+
+namespace pixy2 {
+
+// One snapshot of what the camera sees, copied out of the response buffers.
+struct AcquiredFrame {
+    static constexpr const size_t MAX_BLOCKS = 255 / sizeof(ColorBlock);
+    static constexpr const size_t MAX_VECTORS = 8;
+    static constexpr const size_t MAX_INTERSECTIONS = 4;
+    static constexpr const size_t MAX_BARCODES = 4;
+
+    // 0 means no frame was published yet
+    uint32_t seq = 0;
+    // of the blocks request, or of the line features if blocks are off
+    FrameTiming timing;
+
+    esp_err_t blocksErr = ESP_ERR_INVALID_STATE;
+    uint8_t blockCount = 0;
+    ColorBlock blocks[MAX_BLOCKS];
+
+    esp_err_t linesErr = ESP_ERR_INVALID_STATE;
+    uint8_t vectorCount = 0;
+    uint8_t intersectionCount = 0;
+    uint8_t barcodeCount = 0;
+    LineVector vectors[MAX_VECTORS];
+    LineIntersection intersections[MAX_INTERSECTIONS];
+    LineBarCode barcodes[MAX_BARCODES];
+};
+
+struct AcquisitionConfig {
+    bool blocks = true;
+    uint8_t signaturesMask = 0xFF;
+    uint8_t maxBlocks = AcquiredFrame::MAX_BLOCKS;
+
+    bool lineFeatures = false;
+    LineFeatures features = LineFeatures::ALL;
+    bool allFeatures = false;
+
+    // Pixy2 runs at 60 fps, no point in polling faster
+    TickType_t period = pdMS_TO_TICKS(16);
+
+    // Instead of every period, poll right after the camera has a new frame (see FrameScheduler)
+    // and publish only new frames, and failed polls.
+    bool frameSync = true;
+    FrameSchedulerConfig scheduler;
+
+    // With more cameras, give each its own name, and its own core if they are on separate buses.
+    const char *name = "pixy2acq";
+    BaseType_t core = 0;
+    UBaseType_t priority = 5;
+    uint32_t stackSize = 4096;
+};
+
+// Owns the Pixy2 and polls it from its own task, publishing every frame through a TripleBuffer
+// per reader. Readers never block and never touch the bus, each reader index must be used
+// by one task only (e.g. 0 = motors, 1 = UI, 2 = arm).
+// Must not be moved once started, the task keeps a pointer to it.
+template<typename LinkType, size_t Readers = 3>
+class Acquisition {
+public:
+    Acquisition(Pixy2<LinkType>&& pixy, const AcquisitionConfig& cfg = AcquisitionConfig())
+        : m_pixy(std::move(pixy)), m_cfg(cfg), m_scheduler(cfg.scheduler), m_running(false), m_stop(false), m_seq(0) {
+        if(m_cfg.maxBlocks > AcquiredFrame::MAX_BLOCKS) {
+            m_cfg.maxBlocks = AcquiredFrame::MAX_BLOCKS;
+        }
+    }
+
+    ~Acquisition() {
+        stop();
+    }
+
+    esp_err_t start() {
+        if(m_running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        m_stop = false;
+        m_running = true;
+        if(xTaskCreatePinnedToCore(taskBody, m_cfg.name, m_cfg.stackSize, this, m_cfg.priority, nullptr, m_cfg.core) != pdPASS) {
+            m_running = false;
+            return ESP_ERR_NO_MEM;
+        }
+        return ESP_OK;
+    }
+
+    // Waits until the task finishes its current poll.
+    void stop() {
+        m_stop = true;
+        while(m_running) {
+            vTaskDelay(1);
+        }
+    }
+
+    // The newest frame for reader idx. The reference stays valid until the next latest(idx) call.
+    const AcquiredFrame& latest(size_t idx) {
+        auto& buf = m_outputs[idx];
+        buf.update();
+        return buf.front();
+    }
+
+    // Like latest, but returns nullptr if nothing new was published since the last call.
+    const AcquiredFrame *poll(size_t idx) {
+        auto& buf = m_outputs[idx];
+        return buf.update() ? &buf.front() : nullptr;
+    }
+
+private:
+    Acquisition(const Acquisition&) = delete;
+
+    static void taskBody(void *selfVoid) {
+        auto *self = (Acquisition*)selfVoid;
+        self->run();
+        self->m_running = false;
+        vTaskDelete(nullptr);
+    }
+
+    void run() {
+        if(m_cfg.frameSync) {
+            uint32_t fps = 0;
+            if(m_pixy.getFPS(fps) == ESP_OK) {
+                m_scheduler.setFps(fps);
+            }
+        }
+
+        TickType_t lastWake = xTaskGetTickCount();
+        while(!m_stop) {
+            pollOnce();
+            if(m_cfg.frameSync) {
+                const int64_t now = esp_timer_get_time();
+                const int64_t waitUs = m_scheduler.nextPollUs(now) - now;
+                const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+                vTaskDelay(std::max(int64_t(1), (waitUs + tickUs - 1) / tickUs));
+            } else {
+                vTaskDelayUntil(&lastWake, m_cfg.period);
+            }
+        }
+    }
+
+    void pollOnce() {
+        FrameQuery query;
+        query.signaturesMasks[0] = m_cfg.blocks ? m_cfg.signaturesMask : 0;
+        query.maxBlocks = m_cfg.maxBlocks;
+        query.lineFeatures = m_cfg.lineFeatures;
+        query.features = m_cfg.features;
+        query.allFeatures = m_cfg.allFeatures;
+        m_pixy.getFrame(query, m_frame);
+
+        const esp_err_t blocksErr = m_frame.blocksErr[0];
+        const esp_err_t linesErr = m_frame.linesErr;
+        const auto& blocksCtx = m_frame.blocks[0];
+        const auto& linesCtx = m_frame.lines;
+
+        if(m_cfg.frameSync) {
+            const esp_err_t err = m_cfg.blocks ? blocksErr : linesErr;
+            const bool fresh = m_cfg.blocks
+                ? m_scheduler.onPoll(blocksErr, blocksCtx.timing, blocksCtx.blocks)
+                : m_scheduler.onPoll(linesErr, linesCtx.timing);
+            // errors other than busy are published too, readers have to see a dead link
+            if(!fresh && (err == ESP_OK || err == ERR_PIXY_BUSY)) {
+                return;
+            }
+        }
+
+        const uint32_t seq = ++m_seq;
+        const FrameTiming& timing = m_cfg.blocks ? blocksCtx.timing : linesCtx.timing;
+        for(auto& buf : m_outputs) {
+            auto& frame = buf.back();
+            frame.seq = seq;
+            frame.timing = timing;
+            frame.blocksErr = blocksErr;
+            frame.linesErr = linesErr;
+
+            frame.blockCount = copyOut(frame.blocks, AcquiredFrame::MAX_BLOCKS, blocksErr, blocksCtx.blocks);
+            frame.vectorCount = copyOut(frame.vectors, AcquiredFrame::MAX_VECTORS, linesErr, linesCtx.vectors);
+            frame.intersectionCount = copyOut(frame.intersections, AcquiredFrame::MAX_INTERSECTIONS, linesErr, linesCtx.intersections);
+            frame.barcodeCount = copyOut(frame.barcodes, AcquiredFrame::MAX_BARCODES, linesErr, linesCtx.barcodes);
+            buf.publish();
+        }
+    }
+
+    template<typename T>
+    static uint8_t copyOut(T *dest, size_t capacity, esp_err_t err, const PixySpan<T>& src) {
+        if(err != ESP_OK) {
+            return 0;
+        }
+        const size_t count = std::min(capacity, src.size());
+        memcpy(dest, src.data(), count * sizeof(T));
+        return count;
+    }
+
+    Pixy2<LinkType> m_pixy;
+    AcquisitionConfig m_cfg;
+
+    // only touched from the task, both reads go out in one locked session
+    FrameContext m_frame;
+    FrameScheduler m_scheduler;
+
+    TripleBuffer<AcquiredFrame> m_outputs[Readers];
+
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stop;
+    uint32_t m_seq;
+};
+
+};
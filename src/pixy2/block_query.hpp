@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "packet.hpp"
+#include "pixy2.hpp"
+#include "pixy_span.hpp"
+
+namespace pixy2 {
+
+// Block searches ("largest red block", "nearest to the centre") over one decoded frame.
+// BlockTable copies the packed, unaligned ColorBlocks into one aligned array per field once,
+// a BlockQuery then filters by scanning single columns into a bit set and picks from what is
+// left. No allocations, the table lives wherever the caller keeps it.
+//
+//     static BlockTable<> table;
+//     table.load(ctx);
+//     BlockQuery<> q(table);
+//     const int red = q.signature(1).minArea(50).argmax(table.area);
+//     uint8_t targets[3];
+//     const size_t n = q.reset().signatures(0x06).inside(roi).nearest(158, 104, targets, 3);
+
+// Pixel rectangle, x0/y0 inclusive, x1/y1 exclusive. Blocks are tested by their centre.
+struct Roi {
+    uint16_t x0, y0, x1, y1;
+
+    bool contains(uint16_t x, uint16_t y) const {
+        return x >= x0 && x < x1 && y >= y0 && y < y1;
+    }
+};
+
+// Coarse ROI of any shape, a GRID x GRID grid of cells over the frame.
+class RoiMask {
+public:
+    static constexpr const size_t GRID = 16;
+
+    // the color connected components frame is 316x208
+    RoiMask(uint16_t width = 316, uint16_t height = 208)
+        : m_cellW((width + GRID - 1) / GRID), m_cellH((height + GRID - 1) / GRID), m_rows() {}
+
+    RoiMask& clear() {
+        for(auto& r : m_rows) {
+            r = 0;
+        }
+        return *this;
+    }
+
+    // Adds the cells the rectangle touches.
+    RoiMask& add(const Roi& roi) {
+        if(roi.x1 <= roi.x0 || roi.y1 <= roi.y0) {
+            return *this;
+        }
+        const size_t cx0 = cellX(roi.x0), cx1 = cellX(roi.x1 - 1);
+        const size_t cy0 = cellY(roi.y0), cy1 = cellY(roi.y1 - 1);
+        const uint16_t bits = uint16_t((0xFFFFu >> (GRID - 1 - (cx1 - cx0))) << cx0);
+        for(size_t y = cy0; y <= cy1; ++y) {
+            m_rows[y] |= bits;
+        }
+        return *this;
+    }
+
+    bool contains(uint16_t x, uint16_t y) const {
+        return (m_rows[cellY(y)] >> cellX(x)) & 1;
+    }
+
+private:
+    size_t cellX(uint16_t x) const { return std::min(GRID - 1, size_t(x / m_cellW)); }
+    size_t cellY(uint16_t y) const { return std::min(GRID - 1, size_t(y / m_cellH)); }
+
+    uint16_t m_cellW;
+    uint16_t m_cellH;
+    uint16_t m_rows[GRID];
+};
+
+// One frame of blocks, one column per field. Capacity is at most 64, one response carries
+// at most AcquiredFrame::MAX_BLOCKS (18).
+template<size_t Capacity = 255 / sizeof(ColorBlock)>
+struct BlockTable {
+    static_assert(Capacity <= 64, "BlockQuery keeps the selection in a uint64_t");
+    static constexpr const size_t CAPACITY = Capacity;
+
+    uint8_t count = 0;
+    alignas(16) uint16_t signature[Capacity];
+    alignas(16) uint16_t x[Capacity];
+    alignas(16) uint16_t y[Capacity];
+    alignas(16) uint16_t w[Capacity];
+    alignas(16) uint16_t h[Capacity];
+    // w * h
+    alignas(16) uint32_t area[Capacity];
+    alignas(16) int16_t angle[Capacity];
+    alignas(16) uint8_t index[Capacity];
+    alignas(16) uint8_t age[Capacity];
+
+    // Replaces the contents, blocks past Capacity are left out. Returns how many were loaded.
+    size_t load(const ColorBlock *blocks, size_t n) {
+        count = 0;
+        for(size_t i = 0; i < n; ++i) {
+            add(blocks[i]);
+        }
+        return count;
+    }
+
+    size_t load(const PixySpan<ColorBlock>& blocks) {
+        return load(blocks.data(), blocks.size());
+    }
+
+    size_t load(const GetBlocksContext& ctx) {
+        return load(ctx.blocks);
+    }
+
+    // Appends one block, e.g. from a MergedFrame. Returns false if the table is full.
+    bool add(const ColorBlock& b) {
+        if(count == Capacity) {
+            return false;
+        }
+        const size_t i = count++;
+        signature[i] = b.signature;
+        x[i] = b.x;
+        y[i] = b.y;
+        w[i] = b.w;
+        h[i] = b.h;
+        area[i] = uint32_t(b.w) * b.h;
+        angle[i] = b.angle;
+        index[i] = b.index;
+        age[i] = b.age;
+        return true;
+    }
+
+    ColorBlock block(size_t i) const {
+        ColorBlock b;
+        b.signature = signature[i];
+        b.x = x[i];
+        b.y = y[i];
+        b.w = w[i];
+        b.h = h[i];
+        b.angle = angle[i];
+        b.index = index[i];
+        b.age = age[i];
+        return b;
+    }
+};
+
+// A selection of rows of one BlockTable. The filters narrow it down and chain,
+// the pickers return row indexes into the table, -1 or 0 results if nothing is selected.
+// Load the table before creating the query, or reset() it after loading.
+template<size_t Capacity = 255 / sizeof(ColorBlock)>
+class BlockQuery {
+public:
+    typedef BlockTable<Capacity> Table;
+
+    explicit BlockQuery(const Table& table) : m_table(table) {
+        reset();
+    }
+
+    // Selects every row again.
+    BlockQuery& reset() {
+        m_selected = m_table.count >= 64 ? ~uint64_t(0) : (uint64_t(1) << m_table.count) - 1;
+        return *this;
+    }
+
+    BlockQuery& signature(uint16_t sig) {
+        return keep([sig](const Table& t, size_t i) { return t.signature[i] == sig; });
+    }
+
+    // Bit n-1 for signature n, 1 to 7. Color codes (larger signatures) never match.
+    BlockQuery& signatures(uint8_t mask) {
+        return keep([mask](const Table& t, size_t i) {
+            return t.signature[i] >= 1 && t.signature[i] <= 7 && ((mask >> (t.signature[i] - 1)) & 1);
+        });
+    }
+
+    BlockQuery& minArea(uint32_t area) {
+        return keep([area](const Table& t, size_t i) { return t.area[i] >= area; });
+    }
+
+    BlockQuery& maxArea(uint32_t area) {
+        return keep([area](const Table& t, size_t i) { return t.area[i] <= area; });
+    }
+
+    // Tracked for at least this many frames, filters out single-frame noise.
+    BlockQuery& minAge(uint8_t age) {
+        return keep([age](const Table& t, size_t i) { return t.age[i] >= age; });
+    }
+
+    BlockQuery& inside(const Roi& roi) {
+        return keep([&roi](const Table& t, size_t i) { return roi.contains(t.x[i], t.y[i]); });
+    }
+
+    BlockQuery& inside(const RoiMask& mask) {
+        return keep([&mask](const Table& t, size_t i) { return mask.contains(t.x[i], t.y[i]); });
+    }
+
+    // Anything else: pred(table, row) returns true for the rows to keep.
+    template<typename Pred>
+    BlockQuery& where(Pred pred) {
+        return keep(pred);
+    }
+
+    size_t size() const { return __builtin_popcountll(m_selected); }
+    bool empty() const { return m_selected == 0; }
+    bool selected(size_t row) const { return (m_selected >> row) & 1; }
+
+    // The selected row with the largest (smallest) value in a column of the table,
+    // the first one on ties, -1 if none.
+    template<typename T>
+    int argmax(const T (&column)[Capacity]) const {
+        return pick(column, true);
+    }
+
+    template<typename T>
+    int argmin(const T (&column)[Capacity]) const {
+        return pick(column, false);
+    }
+
+    // The selected rows with the k largest (smallest) values of a column, best first.
+    // out must hold k rows, returns how many were written.
+    template<typename T>
+    size_t top(const T (&column)[Capacity], uint8_t *out, size_t k, bool largest = true) const {
+        uint32_t keys[Capacity];
+        for(size_t i = 0; i < m_table.count; ++i) {
+            const uint32_t v = uint32_t(column[i]) - uint32_t(std::numeric_limits<T>::min());
+            keys[i] = largest ? ~v : v;
+        }
+        return smallest(keys, out, k);
+    }
+
+    // The selected rows nearest to a point, nearest first.
+    size_t nearest(uint16_t px, uint16_t py, uint8_t *out, size_t k) const {
+        uint32_t keys[Capacity];
+        distances(px, py, keys);
+        return smallest(keys, out, k);
+    }
+
+    int nearest(uint16_t px, uint16_t py) const {
+        uint8_t row;
+        return nearest(px, py, &row, 1) != 0 ? row : -1;
+    }
+
+    // fn(row) for every selected row, in table order.
+    template<typename Fn>
+    void forEach(Fn fn) const {
+        for(uint64_t s = m_selected; s != 0; s &= s - 1) {
+            fn(size_t(__builtin_ctzll(s)));
+        }
+    }
+
+private:
+    // One pass over the rows into a bit set, no reordering of the table.
+    template<typename Pred>
+    BlockQuery& keep(Pred pred) {
+        uint64_t keep = 0;
+        for(size_t i = 0; i < m_table.count; ++i) {
+            keep |= uint64_t(pred(m_table, i) ? 1 : 0) << i;
+        }
+        m_selected &= keep;
+        return *this;
+    }
+
+    template<typename T>
+    int pick(const T (&column)[Capacity], bool largest) const {
+        int best = -1;
+        for(uint64_t s = m_selected; s != 0; s &= s - 1) {
+            const int i = __builtin_ctzll(s);
+            if(best < 0 || (largest ? column[i] > column[best] : column[i] < column[best])) {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    void distances(uint16_t px, uint16_t py, uint32_t *keys) const {
+        for(size_t i = 0; i < m_table.count; ++i) {
+            const int32_t dx = int32_t(m_table.x[i]) - px;
+            const int32_t dy = int32_t(m_table.y[i]) - py;
+            keys[i] = uint32_t(dx * dx + dy * dy);
+        }
+    }
+
+    // Insertion into a short sorted list, k is small and so is the table.
+    size_t smallest(const uint32_t *keys, uint8_t *out, size_t k) const {
+        size_t n = 0;
+        for(uint64_t s = m_selected; s != 0 && k != 0; s &= s - 1) {
+            const uint8_t row = __builtin_ctzll(s);
+            if(n == k && keys[row] >= keys[out[n - 1]]) {
+                continue;
+            }
+            size_t pos = n < k ? n++ : n - 1;
+            while(pos > 0 && keys[out[pos - 1]] > keys[row]) {
+                out[pos] = out[pos - 1];
+                --pos;
+            }
+            out[pos] = row;
+        }
+        return n;
+    }
+
+    const Table& m_table;
+    uint64_t m_selected;
+};
+
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <stdint.h>
+
+namespace pixy2 {
+
+// When a call has to be finished, in esp_timer_get_time() microseconds. Pixy2 passes it down
+// to every link read and write, they give up once it has passed and clip their own
+// bus timeouts to what is left.
+class Deadline {
+public:
+    // No limit, the default for the links.
+    Deadline() : m_atUs(NEVER) {}
+
+    static Deadline at(int64_t us) { return Deadline(us); }
+    static Deadline in(int64_t us) { return Deadline(esp_timer_get_time() + us); }
+    static Deadline never() { return Deadline(NEVER); }
+
+    // Stands for Pixy2::callBudget() counted from the start of the call, the default of the Pixy2 calls.
+    static Deadline budget() { return Deadline(BUDGET); }
+
+    bool isBudget() const { return m_atUs == BUDGET; }
+    bool bounded() const { return m_atUs != NEVER; }
+    int64_t atUs() const { return m_atUs; }
+
+    bool expired() const {
+        return bounded() && esp_timer_get_time() >= m_atUs;
+    }
+
+    int64_t remainingUs() const {
+        return bounded() ? std::max(int64_t(0), m_atUs - esp_timer_get_time()) : NEVER;
+    }
+
+    // What is left as a FreeRTOS timeout, at most limit. Rounded up, 0 would mean not to wait at all.
+    TickType_t ticks(TickType_t limit) const {
+        if(!bounded()) {
+            return limit;
+        }
+        const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+        const int64_t t = (remainingUs() + tickUs - 1) / tickUs;
+        return TickType_t(std::max(int64_t(1), std::min(int64_t(limit), t)));
+    }
+
+    Deadline earlier(const Deadline& other) const {
+        return m_atUs <= other.m_atUs ? *this : other;
+    }
+
+private:
+    static constexpr const int64_t NEVER = INT64_MAX;
+    static constexpr const int64_t BUDGET = INT64_MIN;
+
+    explicit Deadline(int64_t atUs) : m_atUs(atUs) {}
+
+    int64_t m_atUs;
+};
+
+};
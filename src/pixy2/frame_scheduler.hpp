@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "packet.hpp"
+#include "pixy2.hpp"
+#include "pixy_span.hpp"
+
+namespace pixy2 {
+
+struct FrameSchedulerConfig {
+    // Used until setFps is called. Pixy2 runs at about 60 fps, less in low light.
+    int64_t periodUs = 16667;
+    // Poll this long after the frame is expected to be ready.
+    int64_t marginUs = 1000;
+    // Poll again this soon after a poll that got nothing new.
+    int64_t retryUs = 1000;
+    // How fast the phase estimate follows the measurements, 0 to 1.
+    float phaseGain = 0.25f;
+    // With no early poll to bracket the ready time, move the estimate this much earlier
+    // every frame, so it cannot settle late.
+    int64_t probeUs = 250;
+};
+
+// Learns when the camera has new frames and tells when to poll, so each frame is read
+// once and soon after it is ready. The period comes from Pixy2::getFPS, the phase
+// is found from which polls got a new frame and which got the old one again.
+//
+// A poll saw an old frame if the Pixy answered busy (ERR_PIXY_BUSY) or if the blocks
+// are the same ones with the same age (age counts frames a block was tracked for).
+// When neither tells, e.g. no blocks or all ages saturated at 255, the time since
+// the last new frame decides.
+class FrameScheduler {
+public:
+    static constexpr const size_t MAX_BLOCKS = 255 / sizeof(ColorBlock);
+
+    FrameScheduler(const FrameSchedulerConfig& cfg = FrameSchedulerConfig())
+        : m_cfg(cfg), m_periodUs(cfg.periodUs), m_readyUs(0), m_locked(false),
+          m_lastNewUs(0), m_lastOldUs(0), m_count(0), m_newFrames(0), m_oldFrames(0) {}
+
+    void setFps(uint32_t fps) {
+        if(fps > 0) {
+            m_periodUs = 1000000 / fps;
+        }
+    }
+
+    int64_t periodUs() const { return m_periodUs; }
+
+    // Feed the result of a blocks poll. Returns true if it is a frame not seen before,
+    // false for errors other than busy too, the caller reports those on its own.
+    bool onPoll(esp_err_t err, const FrameTiming& timing, const ColorBlock *blocks, size_t count) {
+        Verdict v;
+        if(err == ERR_PIXY_BUSY) {
+            v = OLD;
+        } else if(err != ESP_OK) {
+            // says nothing about the camera, poll again on the same schedule
+            return false;
+        } else {
+            v = compareBlocks(blocks, count);
+            if(v == UNKNOWN) {
+                v = timing.requestUs - m_lastNewUs >= m_periodUs * 3 / 4 ? NEW : OLD;
+            }
+        }
+
+        // The Pixy answers with the frame it has when the request arrives.
+        const int64_t t = timing.requestUs;
+        if(v == NEW) {
+            onNew(t);
+            remember(blocks, count);
+            ++m_newFrames;
+            return true;
+        }
+        onOld(t);
+        ++m_oldFrames;
+        return false;
+    }
+
+    bool onPoll(esp_err_t err, const FrameTiming& timing, const PixySpan<ColorBlock>& blocks) {
+        return onPoll(err, timing, blocks.data(), blocks.size());
+    }
+
+    // For polls without blocks, e.g. line features only.
+    bool onPoll(esp_err_t err, const FrameTiming& timing) {
+        return onPoll(err, timing, nullptr, 0);
+    }
+
+    // esp_timer_get_time() to poll at next, nowUs at the soonest.
+    int64_t nextPollUs(int64_t nowUs) const {
+        if(!m_locked || m_lastOldUs != 0) {
+            return std::max(nowUs, (m_lastOldUs != 0 ? m_lastOldUs : nowUs) + m_cfg.retryUs);
+        }
+
+        // m_readyUs is the frame we have, wait for the one after it
+        return std::max(nowUs, m_readyUs + m_periodUs + m_cfg.marginUs);
+    }
+
+    // the estimated time when the newest frame became ready
+    int64_t readyUs() const { return m_readyUs; }
+
+    uint32_t newFrames() const { return m_newFrames; }
+    uint32_t oldFrames() const { return m_oldFrames; }
+
+private:
+    enum Verdict : uint8_t {
+        NEW,
+        OLD,
+        UNKNOWN,
+    };
+
+    Verdict compareBlocks(const ColorBlock *blocks, size_t count) const {
+        if(count != m_count) {
+            return NEW;
+        }
+
+        bool old = false;
+        for(size_t i = 0; i < count; ++i) {
+            const auto& b = blocks[i];
+            size_t prev = 0;
+            while(prev < m_count && (m_index[prev] != b.index || m_signature[prev] != b.signature)) {
+                ++prev;
+            }
+
+            if(prev == m_count || b.age > m_age[prev]) {
+                return NEW;
+            } else if(b.age == m_age[prev] && b.age < 255) {
+                old = true;
+            }
+        }
+        return old ? OLD : UNKNOWN;
+    }
+
+    void remember(const ColorBlock *blocks, size_t count) {
+        m_count = std::min(count, MAX_BLOCKS);
+        for(size_t i = 0; i < m_count; ++i) {
+            m_index[i] = blocks[i].index;
+            m_signature[i] = blocks[i].signature;
+            m_age[i] = blocks[i].age;
+        }
+    }
+
+    void onNew(int64_t t) {
+        if(!m_locked) {
+            m_readyUs = t;
+            m_locked = true;
+        } else if(m_lastOldUs != 0) {
+            // became ready between the last old poll and this one
+            correct((m_lastOldUs + t) / 2);
+        } else {
+            const int64_t predicted = nearestReady(t);
+            if(predicted > t) {
+                correct(t);
+            } else {
+                m_readyUs -= m_cfg.probeUs;
+            }
+        }
+        m_readyUs = nearestReady(t);
+        if(m_readyUs > t) {
+            m_readyUs -= m_periodUs;
+        }
+        m_lastNewUs = t;
+        m_lastOldUs = 0;
+    }
+
+    void onOld(int64_t t) {
+        // not ready at t, so if we expected it to be, we are early
+        if(m_locked && m_lastNewUs != 0 && t - m_lastNewUs < 2 * m_periodUs) {
+            const int64_t expected = nearestReady(m_lastNewUs) + m_periodUs;
+            if(expected <= t) {
+                correct(t + m_cfg.retryUs / 2);
+            }
+        }
+        m_lastOldUs = t;
+    }
+
+    // move the phase towards a measured ready time
+    void correct(int64_t measuredUs) {
+        const int64_t error = measuredUs - nearestReady(measuredUs);
+        m_readyUs += int64_t(error * m_cfg.phaseGain);
+    }
+
+    // the ready time closest to t, according to the current estimate
+    int64_t nearestReady(int64_t t) const {
+        const int64_t diff = t - m_readyUs;
+        int64_t k = diff / m_periodUs;
+        int64_t rem = diff - k * m_periodUs;
+        if(rem > m_periodUs / 2) {
+            ++k;
+        } else if(rem < -m_periodUs / 2) {
+            --k;
+        }
+        return m_readyUs + k * m_periodUs;
+    }
+
+    FrameSchedulerConfig m_cfg;
+    int64_t m_periodUs;
+
+    int64_t m_readyUs;
+    bool m_locked;
+    int64_t m_lastNewUs;
+    // time of the last poll that got an old frame, 0 if there was none since the last new one
+    int64_t m_lastOldUs;
+
+    size_t m_count;
+    uint8_t m_index[MAX_BLOCKS];
+    uint16_t m_signature[MAX_BLOCKS];
+    uint8_t m_age[MAX_BLOCKS];
+
+    uint32_t m_newFrames;
+    uint32_t m_oldFrames;
+};
+
+};
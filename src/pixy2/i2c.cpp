@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <string.h>
+
 #include "i2c.hpp"
 
 namespace pixy2 {
@@ -9,6 +12,8 @@ namespace pixy2 {
         }                                                               \
     } while(0)
 
+// Official Arduino lib limits writes at 16
+static constexpr const size_t WRITE_CHUNK = 16;
 
 class I2cCmdHolder {
 public:
@@ -26,35 +31,100 @@ private:
     i2c_cmd_handle_t m_cmd;
 };
 
-esp_err_t LinkI2C::receiveData(uint8_t *dest, size_t len) const
+// Writes txLen bytes (if any), then reads rxLen bytes (if any) after a repeated start.
+static esp_err_t buildCommand(i2c_cmd_handle_t cmd, uint8_t address, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen) {
+    if (txLen > 0) {
+        RETURN_IF_ERR(i2c_master_start(cmd));
+        RETURN_IF_ERR(i2c_master_write_byte(cmd, address << 1, true));
+        // RETURN_IF_ERR(i2c_master_write(cmd, tx, txLen, I2C_MASTER_LAST_NACK)); // esp-idf variant
+        RETURN_IF_ERR(i2c_master_write(cmd, (uint8_t*)tx, txLen, I2C_MASTER_LAST_NACK));
+    }
+    if (rxLen > 0) {
+        RETURN_IF_ERR(i2c_master_start(cmd));
+        RETURN_IF_ERR(i2c_master_write_byte(cmd, address << 1 | 1, true));
+        RETURN_IF_ERR(i2c_master_read(cmd, rx, rxLen, I2C_MASTER_LAST_NACK));
+    }
+    RETURN_IF_ERR(i2c_master_stop(cmd));
+    return ESP_OK;
+}
+
+// combinedTransfers: request held back until the next receiveData
+struct LinkI2C::PendingRequest {
+    PendingRequest() : len(0) {}
+
+    uint8_t tx[WRITE_CHUNK];
+    size_t len;
+};
+
+LinkI2C::LinkI2C(i2c_port_t bus, uint8_t address, bool ownsBus, const LinkI2COptions& options)
+    : m_bus_num(bus), m_address(address), m_ownsBus(ownsBus), m_options(options) {
+    if (options.combinedTransfers) {
+        m_pending.reset(new PendingRequest());
+    }
+}
+
+LinkI2C::LinkI2C(LinkI2C&& other) : m_bus_num(other.m_bus_num), m_address(other.m_address), m_ownsBus(false),
+    m_options(other.m_options), m_pending(std::move(other.m_pending)) {
+    if(other.m_ownsBus) {
+        this->m_ownsBus = true;
+        other.m_ownsBus = false;
+    }
+}
+
+LinkI2C::~LinkI2C() {
+    if(m_ownsBus) {
+        i2c_driver_delete(m_bus_num);
+    }
+}
+
+esp_err_t LinkI2C::transfer(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen, const Deadline& dl) const
 {
+    if (dl.expired())
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // IDF 3.x consumes the command link while executing it, so a new one every time.
     I2cCmdHolder holder;
     auto cmd = holder.get();
 
-    RETURN_IF_ERR(i2c_master_start(cmd));
-    RETURN_IF_ERR(i2c_master_write_byte(cmd, m_address << 1 | 1, true));
-    RETURN_IF_ERR(i2c_master_read(cmd, dest, len, I2C_MASTER_LAST_NACK));
-    RETURN_IF_ERR(i2c_master_stop(cmd));
-    RETURN_IF_ERR(i2c_master_cmd_begin(m_bus_num, cmd, pdMS_TO_TICKS(25)));
+    RETURN_IF_ERR(buildCommand(cmd, m_address, tx, txLen, rx, rxLen));
+    RETURN_IF_ERR(i2c_master_cmd_begin(m_bus_num, cmd, dl.ticks(m_options.timeout)));
     return ESP_OK;
 }
 
-esp_err_t LinkI2C::sendData(const uint8_t *data, size_t len) const
+esp_err_t LinkI2C::receiveData(uint8_t *dest, size_t len, const Deadline& dl) const
 {
+    if (m_pending && m_pending->len != 0)
+    {
+        const size_t txLen = m_pending->len;
+        m_pending->len = 0;
+        return transfer(m_pending->tx, txLen, dest, len, dl);
+    }
+    return transfer(nullptr, 0, dest, len, dl);
+}
+
+esp_err_t LinkI2C::sendData(const uint8_t *data, size_t len, const Deadline& dl) const
+{
+    // A request still held back here never got its response read, the call it
+    // belonged to gave up. Sending it now would answer the wrong request.
+    if (m_pending)
+    {
+        m_pending->len = 0;
+    }
+
+    if (m_options.combinedTransfers && len <= WRITE_CHUNK)
+    {
+        memcpy(m_pending->tx, data, len);
+        m_pending->len = len;
+        return ESP_OK;
+    }
+
     while (len > 0)
     {
-        // Official Arduino lib limits at 16
-        const size_t chunk = std::min(16U, len);
+        const size_t chunk = std::min(WRITE_CHUNK, len);
 
-        I2cCmdHolder holder;
-        auto cmd = holder.get();
-        
-        RETURN_IF_ERR(i2c_master_start(cmd));
-        RETURN_IF_ERR(i2c_master_write_byte(cmd, m_address << 1, true));
-        // RETURN_IF_ERR(i2c_master_write(cmd, data, chunk, I2C_MASTER_LAST_NACK)); // esp-idf variant
-        RETURN_IF_ERR(i2c_master_write(cmd, (uint8_t*)data, chunk, I2C_MASTER_LAST_NACK));
-        RETURN_IF_ERR(i2c_master_stop(cmd));
-        RETURN_IF_ERR(i2c_master_cmd_begin(m_bus_num, cmd, pdMS_TO_TICKS(25)));
+        RETURN_IF_ERR(transfer(data, chunk, nullptr, 0, dl));
 
         data += chunk;
         len -= chunk;
@@ -62,4 +132,14 @@ esp_err_t LinkI2C::sendData(const uint8_t *data, size_t len) const
     return ESP_OK;
 }
 
+esp_err_t LinkI2C::recover(const Deadline&) const
+{
+    if (m_pending)
+    {
+        m_pending->len = 0;
+    }
+    RETURN_IF_ERR(i2c_reset_tx_fifo(m_bus_num));
+    return i2c_reset_rx_fifo(m_bus_num);
+}
+
 };
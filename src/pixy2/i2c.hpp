@@ -1,17 +1,32 @@
+#pragma once
+
 #include <driver/i2c.h>
+#include <memory>
 #include <tuple>
 
+#include "deadline.hpp"
+
 namespace pixy2 {
 
+struct LinkI2COptions {
+    // How long a single bus command may take, less if the call's deadline is closer.
+    TickType_t timeout = pdMS_TO_TICKS(25);
+
+    // Send the request and read the response in one command, with a repeated start in between.
+    // The request is held back until the next receiveData. Requests over 16 bytes are sent alone.
+    bool combinedTransfers = false;
+};
+
 class LinkI2C {
 public:
 
-    static LinkI2C withoutBusInit(i2c_port_t bus_num, uint8_t address) {
-        return LinkI2C(bus_num, address, false);
+    static LinkI2C withoutBusInit(i2c_port_t bus_num, uint8_t address, const LinkI2COptions& options = LinkI2COptions()) {
+        return LinkI2C(bus_num, address, false, options);
     }
 
     static std::tuple<LinkI2C, esp_err_t> withBusInit(i2c_port_t bus_num, uint8_t address,
-        gpio_num_t sda_pin, gpio_num_t scl_pin, uint32_t speed_hz = 500000) {
+        gpio_num_t sda_pin, gpio_num_t scl_pin, uint32_t speed_hz = 500000,
+        const LinkI2COptions& options = LinkI2COptions()) {
         
         i2c_config_t conf;
         conf.mode = I2C_MODE_MASTER;
@@ -23,7 +38,7 @@ public:
                 .clk_speed = speed_hz
         };       
 
-        auto instance = LinkI2C(bus_num, address, true);
+        auto instance = LinkI2C(bus_num, address, true, options);
 
         esp_err_t err = i2c_param_config(bus_num, &conf);
         if(err != ESP_OK) {
@@ -38,30 +53,30 @@ public:
         return std::make_tuple(std::move(instance), ESP_OK);
     }
 
-    LinkI2C(LinkI2C&& other) : m_bus_num(other.m_bus_num), m_address(other.m_address) {
-        if(other.m_ownsBus) {
-            this->m_ownsBus = true;
-            other.m_ownsBus = false;
-        }
-    }
+    LinkI2C(LinkI2C&& other);
+    ~LinkI2C();
 
-    ~LinkI2C() {
-        if(m_ownsBus) {
-            i2c_driver_delete(m_bus_num);
-        }
-    }
+    esp_err_t receiveData(uint8_t *dest, size_t len, const Deadline& dl = Deadline()) const;
+    esp_err_t sendData(const uint8_t *data, size_t len, const Deadline& dl = Deadline()) const;
 
-    esp_err_t receiveData(uint8_t *dest, size_t len) const;
-    esp_err_t sendData(const uint8_t *data, size_t len) const;
+    // Drops a held back request and clears the controller's FIFOs after an aborted transfer.
+    // The driver resets its state machine by itself on the command after a timeout.
+    esp_err_t recover(const Deadline& dl = Deadline()) const;
 
 private:
-    LinkI2C(i2c_port_t bus, uint8_t address, bool ownsBus = false) : m_bus_num(bus), m_address(address), m_ownsBus(ownsBus) {
+    struct PendingRequest;
 
-    }
+    LinkI2C(i2c_port_t bus, uint8_t address, bool ownsBus, const LinkI2COptions& options);
+
+    esp_err_t transfer(const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen, const Deadline& dl) const;
 
     i2c_port_t m_bus_num;
     uint8_t m_address;
     bool m_ownsBus;
+    LinkI2COptions m_options;
+
+    // only with combinedTransfers, the calls are const
+    std::unique_ptr<PendingRequest> m_pending;
 };
 
 };
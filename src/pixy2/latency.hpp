@@ -0,0 +1,105 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include "packet.hpp"
+
+namespace pixy2 {
+
+// How the robot moves, in its own frame: forward speed and turning rate (left is positive).
+struct RobotMotion {
+    float forwardMmPerS = 0;
+    float yawRadPerS = 0;
+
+    // From encoder tick deltas of a differential drive measured over dtUs.
+    static RobotMotion fromEncoders(int32_t leftTicks, int32_t rightTicks, int64_t dtUs, float mmPerTick, float wheelBaseMm) {
+        RobotMotion m;
+        if(dtUs <= 0) {
+            return m;
+        }
+        const float dt = dtUs * 1e-6f;
+        const float left = leftTicks * mmPerTick;
+        const float right = rightTicks * mmPerTick;
+        m.forwardMmPerS = (left + right) / 2 / dt;
+        m.yawRadPerS = (right - left) / wheelBaseMm / dt;
+        return m;
+    }
+};
+
+// Pinhole model of the camera, mounted facing forward and tilted down, looking at flat floor.
+// Defaults are Pixy2's color connected components mode.
+struct CameraModel {
+    uint16_t width = 316;
+    uint16_t height = 208;
+    float horizontalFovRad = 60 * M_PI / 180;
+    float verticalFovRad = 40 * M_PI / 180;
+
+    float heightMm = 150;
+    float tiltDownRad = 20 * M_PI / 180;
+};
+
+// Moves a pixel seen at captureUs to where it would be at nowUs, given how the robot moved in between.
+// Points on the floor are moved through the ground plane, points above the horizon only turn with the robot.
+inline void projectPixel(float& u, float& v, int64_t captureUs, int64_t nowUs, const RobotMotion& motion, const CameraModel& cam) {
+    const float dt = (nowUs - captureUs) * 1e-6f;
+    if(dt <= 0) {
+        return;
+    }
+
+    const float cx = cam.width / 2.f;
+    const float cy = cam.height / 2.f;
+    const float fx = cx / tanf(cam.horizontalFovRad / 2);
+    const float fy = cy / tanf(cam.verticalFovRad / 2);
+    const float cosT = cosf(cam.tiltDownRad);
+    const float sinT = sinf(cam.tiltDownRad);
+    const float turn = motion.yawRadPerS * dt;
+
+    // camera ray: x right, y down, z forward
+    const float rx = (u - cx) / fx;
+    const float ry = (v - cy) / fy;
+    const float forward = cosT - ry * sinT;
+    const float down = sinT + ry * cosT;
+
+    if(down <= 1e-3f) {
+        u += turn * fx;
+        return;
+    }
+
+    // floor point in robot frame, X forward, Y left
+    const float s = cam.heightMm / down;
+    const float X = s * forward - motion.forwardMmPerS * dt;
+    const float Y = -s * rx;
+
+    const float cosR = cosf(turn);
+    const float sinR = sinf(turn);
+    const float X2 = X * cosR + Y * sinR;
+    const float Y2 = -X * sinR + Y * cosR;
+
+    // back to the camera
+    const float z = X2 * cosT + cam.heightMm * sinT;
+    if(z <= 1e-3f) {
+        return;
+    }
+    const float y = -X2 * sinT + cam.heightMm * cosT;
+    u = cx + fx * -Y2 / z;
+    v = cy + fy * y / z;
+}
+
+struct ProjectedBlock {
+    uint16_t signature;
+    // center, in camera pixels
+    float x, y;
+};
+
+inline ProjectedBlock projectBlock(const ColorBlock& block, int64_t captureUs, int64_t nowUs,
+    const RobotMotion& motion, const CameraModel& cam = CameraModel()) {
+    ProjectedBlock p;
+    p.signature = block.signature;
+    p.x = block.x;
+    p.y = block.y;
+    projectPixel(p.x, p.y, captureUs, nowUs, motion, cam);
+    return p;
+}
+
+};
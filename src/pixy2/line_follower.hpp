@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdint.h>
+
+#include "frame_scheduler.hpp"
+#include "pixy2.hpp"
+
+namespace pixy2 {
+
+// Line following on the Pixy2 line program (select it in PixyMon, the driver does not switch
+// programs). In steady state only the main vector is requested, 8 bytes of response instead
+// of the 64 of all features. When the main vector says an intersection is ahead, or a bar code
+// was seen, it switches to full-feature requests for a few frames, so the callback can pick
+// a branch or read the code, then drops back.
+//
+//     static LineFollower<LinkSpi> follower(Pixy2<LinkSpi>(std::move(link)), cfg);
+//     follower.start();
+
+enum class LineMode : uint8_t {
+    // main vector only
+    STEADY,
+    // the main vector and bar codes, every barcodeProbeFrames
+    PROBE,
+    // fullFeatures, near intersections and bar codes
+    FULL,
+};
+
+// What one camera frame made of the line.
+struct LineSteering {
+    uint32_t seq;
+    FrameTiming timing;
+    // the request this frame came from
+    LineMode mode;
+    // of the request, e.g. ERR_PIXY_LINK_DOWN, the lines are empty then
+    esp_err_t err;
+
+    // false if the camera lost the line or the request failed, steer is then 0
+    // and the callback decides what to do
+    bool valid;
+    LineVector vector;
+
+    // Q15, positive turns right, saturates at +-32767
+    int16_t steer;
+    // Q15, where the head of the vector is, -32768 at the left edge, 32768 at the right
+    int32_t offset;
+    // Q15, tangent of the vector's heading from straight ahead, positive to the right
+    int32_t heading;
+};
+
+// Called from the follower's task for every new frame. lines is what the camera sent,
+// in STEADY only the main vector, valid until the callback returns.
+typedef void (*LineSteeringWriter)(const LineSteering& s, const LineFeaturesContext& lines, void *ctx);
+
+struct LineFollowerConfig {
+    LineSteeringWriter write = nullptr;
+    void *writeCtx = nullptr;
+
+    // Q8 gains, steer per Q15 offset, per Q15 heading, and per change of offset per frame period
+    int16_t kOffset = 256;
+    int16_t kHeading = 128;
+    int16_t kDerivative = 64;
+
+    // width of the line program's frame (79x52)
+    uint8_t frameWidth = 79;
+
+    // Frames to stay in FULL after the last intersection flag or bar code.
+    uint8_t holdFrames = 10;
+    // Bar codes are not flagged on the main vector, ask for them every this many frames, 0 never.
+    uint8_t barcodeProbeFrames = 6;
+    // What FULL asks for. The main vector already comes with the intersection and bar codes.
+    // fullAllFeatures returns every vector in view in no particular order, the steering then
+    // follows the one with the index the main vector had last.
+    LineFeatures fullFeatures = LineFeatures::ALL;
+    bool fullAllFeatures = false;
+
+    // Poll right after the camera has a new frame, see FrameScheduler.
+    FrameSchedulerConfig scheduler;
+
+    const char *name = "pixy2line";
+    BaseType_t core = 0;
+    UBaseType_t priority = 6;
+    uint32_t stackSize = 4096;
+};
+
+// Owns the Pixy2 and polls it from its own task at camera rate, like Acquisition.
+// Must not be moved once started, the task keeps a pointer to it.
+template<typename LinkType>
+class LineFollower {
+public:
+    LineFollower(Pixy2<LinkType>&& pixy, const LineFollowerConfig& cfg = LineFollowerConfig())
+        : m_pixy(std::move(pixy)), m_cfg(cfg), m_scheduler(cfg.scheduler), m_running(false), m_stop(false),
+          m_seq(0), m_mode(LineMode::STEADY), m_holdLeft(0), m_sinceProbe(0), m_mainIndex(0), m_haveLast(false),
+          m_lastOffset(0), m_lastCaptureUs(0), m_frames(0), m_fullFrames(0) {}
+
+    ~LineFollower() {
+        stop();
+    }
+
+    esp_err_t start() {
+        if(m_running) {
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        m_stop = false;
+        m_running = true;
+        if(xTaskCreatePinnedToCore(taskBody, m_cfg.name, m_cfg.stackSize, this, m_cfg.priority, nullptr, m_cfg.core) != pdPASS) {
+            m_running = false;
+            return ESP_ERR_NO_MEM;
+        }
+        return ESP_OK;
+    }
+
+    // Waits until the task finishes its current poll.
+    void stop() {
+        m_stop = true;
+        while(m_running) {
+            vTaskDelay(1);
+        }
+    }
+
+    // One poll and, if the frame is new, one control step. Called by the task, or directly
+    // instead of start() from a task that already runs at camera rate. Failed polls (other
+    // than busy) are passed to the callback too. Returns true if the callback was called.
+    bool update() {
+        const LineMode mode = m_mode;
+        esp_err_t err;
+        if(mode == LineMode::FULL) {
+            err = m_pixy.getLineFeatures(m_lines, m_cfg.fullFeatures, m_cfg.fullAllFeatures);
+        } else if(mode == LineMode::PROBE) {
+            err = m_pixy.getLineFeatures(m_lines, LineFeatures(LineFeatures::VECTORS | LineFeatures::BARCODES), false);
+        } else {
+            err = m_pixy.getLineFeatures(m_lines, LineFeatures::VECTORS, false);
+        }
+
+        const bool allFeatures = mode == LineMode::FULL && m_cfg.fullAllFeatures;
+        const bool fresh = m_scheduler.onPoll(err, m_lines.timing);
+        if(!fresh && (err == ESP_OK || err == ERR_PIXY_BUSY)) {
+            return false;
+        }
+        ++m_frames;
+        if(mode == LineMode::FULL) {
+            ++m_fullFrames;
+        }
+
+        LineSteering s;
+        s.seq = ++m_seq;
+        s.timing = m_lines.timing;
+        s.mode = mode;
+        s.err = err;
+        const LineVector *main = err == ESP_OK ? mainVector(allFeatures) : nullptr;
+        s.valid = main != nullptr && !(main->flags & LineFlags::INVALID);
+        s.steer = 0;
+        s.offset = 0;
+        s.heading = 0;
+        if(s.valid) {
+            s.vector = *main;
+            if(!allFeatures) {
+                m_mainIndex = main->index;
+            }
+            steer(s);
+        } else {
+            s.vector = LineVector();
+            m_haveLast = false;
+        }
+
+        // a failed request is asked for again
+        if(err == ESP_OK) {
+            nextMode(s);
+        }
+
+        if(m_cfg.write != nullptr) {
+            m_cfg.write(s, m_lines, m_cfg.writeCtx);
+        }
+        return true;
+    }
+
+    // frames handed to the callback, failed polls included, and how many of them needed a FULL request
+    uint32_t frames() const { return m_frames; }
+    uint32_t fullFrames() const { return m_fullFrames; }
+
+private:
+    LineFollower(const LineFollower&) = delete;
+
+    static void taskBody(void *selfVoid) {
+        auto *self = (LineFollower*)selfVoid;
+        self->run();
+        self->m_running = false;
+        vTaskDelete(nullptr);
+    }
+
+    void run() {
+        uint32_t fps = 0;
+        if(m_pixy.getFPS(fps) == ESP_OK) {
+            m_scheduler.setFps(fps);
+        }
+
+        while(!m_stop) {
+            update();
+            const int64_t now = esp_timer_get_time();
+            const int64_t waitUs = m_scheduler.nextPollUs(now) - now;
+            const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+            vTaskDelay(std::max(int64_t(1), (waitUs + tickUs - 1) / tickUs));
+        }
+    }
+
+    static int16_t saturate(int64_t v) {
+        return int16_t(std::max(int64_t(-32767), std::min(int64_t(32767), v)));
+    }
+
+    // PD on where the vector's head is, plus its heading.
+    void steer(LineSteering& s) {
+        const LineVector& v = s.vector;
+
+        // in half pixels from the centre, then to Q15 of half the width
+        const int32_t halfSpan = std::max(1, m_cfg.frameWidth - 1);
+        s.offset = (int32_t(v.x1) * 2 - halfSpan) * 32768 / halfSpan;
+
+        // The vector points away from the robot, y grows downwards. A vector pointing down
+        // or sideways is clamped to 45 degrees.
+        const int32_t dx = int32_t(v.x1) - v.x0;
+        const int32_t dy = std::max(int32_t(1), int32_t(v.y0) - v.y1);
+        s.heading = std::max(int32_t(-32768), std::min(int32_t(32768), dx * 32768 / dy));
+
+        int32_t derivative = 0;
+        if(m_haveLast && s.timing.captureUs > m_lastCaptureUs) {
+            // per frame period, so the gain does not depend on the camera's fps
+            const int64_t dtUs = s.timing.captureUs - m_lastCaptureUs;
+            const int64_t d = int64_t(s.offset - m_lastOffset) * m_scheduler.periodUs() / dtUs;
+            derivative = int32_t(std::max(int64_t(-65536), std::min(int64_t(65536), d)));
+        }
+        m_haveLast = true;
+        m_lastOffset = s.offset;
+        m_lastCaptureUs = s.timing.captureUs;
+
+        const int64_t out = (int64_t(m_cfg.kOffset) * s.offset + int64_t(m_cfg.kHeading) * s.heading
+            + int64_t(m_cfg.kDerivative) * derivative) >> 8;
+        s.steer = saturate(out);
+    }
+
+    const LineVector *mainVector(bool allFeatures) const {
+        if(!allFeatures) {
+            return m_lines.vectors.size() != 0 ? m_lines.vectors[0] : nullptr;
+        }
+        for(size_t i = 0; i < m_lines.vectors.size(); ++i) {
+            if(m_lines.vectors[i]->index == m_mainIndex) {
+                return m_lines.vectors[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void nextMode(const LineSteering& s) {
+        const bool intersection = s.valid && (s.vector.flags & LineFlags::INTERSECTION_PRESENT);
+        const bool barcode = m_lines.barcodes.size() != 0;
+        if(intersection || barcode) {
+            m_holdLeft = m_cfg.holdFrames;
+            m_mode = LineMode::FULL;
+            return;
+        }
+        if(m_mode == LineMode::FULL && m_holdLeft > 0 && --m_holdLeft > 0) {
+            return;
+        }
+
+        if(m_cfg.barcodeProbeFrames != 0 && ++m_sinceProbe >= m_cfg.barcodeProbeFrames) {
+            m_sinceProbe = 0;
+            m_mode = LineMode::PROBE;
+        } else {
+            m_mode = LineMode::STEADY;
+        }
+    }
+
+    Pixy2<LinkType> m_pixy;
+    LineFollowerConfig m_cfg;
+
+    // only touched from the task
+    LineFeaturesContext m_lines;
+    FrameScheduler m_scheduler;
+
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stop;
+
+    uint32_t m_seq;
+    LineMode m_mode;
+    uint8_t m_holdLeft;
+    uint8_t m_sinceProbe;
+    uint8_t m_mainIndex;
+
+    bool m_haveLast;
+    int32_t m_lastOffset;
+    int64_t m_lastCaptureUs;
+
+    std::atomic<uint32_t> m_frames;
+    std::atomic<uint32_t> m_fullFrames;
+};
+
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+#include <tuple>
+#include <vector>
+
+#include "deadline.hpp"
+#include "packet.hpp"
+
+namespace pixy2 {
+
+// Byte stream that the fake camera "sends" back, shared by LinkMock and the test code.
+// The link gets moved into Pixy2, so the script lives outside of it and keeps the counters.
+class MockScript {
+public:
+    enum Underrun : uint8_t {
+        UNDERRUN_FILL, // return zeros, like the Pixy on SPI when it has nothing to say
+        UNDERRUN_ERROR, // return ESP_ERR_TIMEOUT, like a NACK on I2C
+    };
+
+    struct Counters {
+        uint32_t sendCalls = 0;
+        uint32_t receiveCalls = 0;
+        uint32_t bytesSent = 0;
+        uint32_t bytesReceived = 0;
+        uint32_t recoveries = 0;
+    };
+
+    MockScript() {
+        // No allocations once the script is running, so the bench does not count ours.
+        m_pending.reserve(4096);
+        m_responses.reserve(8);
+    }
+
+    void setUnderrun(Underrun mode) { m_underrun = mode; }
+
+    // Every receive takes this long, like a slow or stuck bus. Cut short with ESP_ERR_TIMEOUT
+    // at the deadline, like the bus timeouts of the real links.
+    void setReceiveDelay(int64_t us) { m_receiveDelayUs = us; }
+
+    // Append raw bytes to the stream.
+    void push(const uint8_t *data, size_t len) {
+        compact();
+        m_pending.insert(m_pending.end(), data, data + len);
+    }
+
+    void pushGarbage(size_t count, uint8_t value = 0x55) {
+        compact();
+        m_pending.insert(m_pending.end(), count, value);
+    }
+
+    // Append a whole response frame with a correct header and checksum.
+    void pushPacket(PacketType type, const uint8_t *payload, uint8_t len, bool withCsum = true) {
+        uint8_t frame[6 + 255];
+        const size_t frameLen = buildPacket(frame, type, payload, len, withCsum);
+        push(frame, frameLen);
+    }
+
+    // Append a frame whose checksum does not match the payload.
+    void pushBadCsumPacket(PacketType type, const uint8_t *payload, uint8_t len) {
+        uint8_t frame[6 + 255];
+        const size_t frameLen = buildPacket(frame, type, payload, len, true);
+        frame[4] ^= 0xFF;
+        push(frame, frameLen);
+    }
+
+    // Append only the first cutAt bytes of a frame, the rest is an underrun.
+    void pushShortPacket(PacketType type, const uint8_t *payload, uint8_t len, size_t cutAt) {
+        uint8_t frame[6 + 255];
+        const size_t frameLen = buildPacket(frame, type, payload, len, true);
+        push(frame, std::min(cutAt, frameLen));
+    }
+
+    // Automatically queue this frame (preceded by garbageBefore junk bytes) whenever
+    // a request of reqType is sent. Lets the benchmarks loop without re-scripting.
+    void respondTo(PacketType reqType, PacketType respType, const uint8_t *payload, uint8_t len,
+        size_t garbageBefore = 0) {
+        AutoResponse r;
+        r.reqType = reqType;
+        r.garbageBefore = garbageBefore;
+        r.frameLen = buildPacket(r.frame, respType, payload, len, true);
+        m_responses.push_back(r);
+    }
+
+    size_t available() const { return m_pending.size() - m_cursor; }
+
+    const Counters& counters() const { return m_counters; }
+    void resetCounters() { m_counters = Counters(); }
+
+    esp_err_t receive(uint8_t *dest, size_t len, int64_t deadlineUs = INT64_MAX) {
+        if (m_receiveDelayUs > 0) {
+            const int64_t done = esp_timer_get_time() + m_receiveDelayUs;
+            const int64_t until = std::min(done, deadlineUs);
+            while (esp_timer_get_time() < until) {
+            }
+            if (until < done) {
+                return ESP_ERR_TIMEOUT;
+            }
+        }
+        ++m_counters.receiveCalls;
+        m_counters.bytesReceived += len;
+
+        const size_t have = std::min(len, available());
+        memcpy(dest, m_pending.data() + m_cursor, have);
+        m_cursor += have;
+
+        if (have < len) {
+            if (m_underrun == UNDERRUN_ERROR) {
+                return ESP_ERR_TIMEOUT;
+            }
+            memset(dest + have, 0, len - have);
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t send(const uint8_t *data, size_t len) {
+        ++m_counters.sendCalls;
+        m_counters.bytesSent += len;
+
+        if (len < 3) {
+            return ESP_OK;
+        }
+
+        for (const auto& r : m_responses) {
+            if (r.reqType == data[2]) {
+                // Whatever the previous request left unread is lost, same as on the real camera.
+                m_pending.clear();
+                m_cursor = 0;
+                pushGarbage(r.garbageBefore);
+                push(r.frame, r.frameLen);
+                break;
+            }
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t recover() {
+        ++m_counters.recoveries;
+        return ESP_OK;
+    }
+
+    static size_t buildPacket(uint8_t *dest, PacketType type, const uint8_t *payload, uint8_t len, bool withCsum) {
+        size_t off = 0;
+        dest[off++] = withCsum ? HDR0_CSUM : HDR0_PLAIN;
+        dest[off++] = HDR1;
+        dest[off++] = type;
+        dest[off++] = len;
+        if (withCsum) {
+            uint16_t csum = 0;
+            for (size_t i = 0; i < len; ++i) {
+                csum += payload[i];
+            }
+            dest[off++] = csum & 0xFF;
+            dest[off++] = csum >> 8;
+        }
+        memcpy(dest + off, payload, len);
+        return off + len;
+    }
+
+private:
+    struct AutoResponse {
+        PacketType reqType;
+        size_t garbageBefore;
+        size_t frameLen;
+        uint8_t frame[6 + 255];
+    };
+
+    void compact() {
+        if (m_cursor == m_pending.size()) {
+            m_pending.clear();
+            m_cursor = 0;
+        }
+    }
+
+    std::vector<uint8_t> m_pending;
+    size_t m_cursor = 0;
+    std::vector<AutoResponse> m_responses;
+    Underrun m_underrun = UNDERRUN_FILL;
+    int64_t m_receiveDelayUs = 0;
+    Counters m_counters;
+};
+
+// Link that talks to a MockScript instead of a bus. Builds on the host.
+class LinkMock {
+public:
+    explicit LinkMock(MockScript& script) : m_script(&script) {}
+
+    LinkMock(LinkMock&& other) : m_script(other.m_script) {}
+
+    esp_err_t receiveData(uint8_t *dest, size_t len, const Deadline& dl = Deadline()) const {
+        if (dl.expired()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        return m_script->receive(dest, len, dl.atUs());
+    }
+
+    esp_err_t sendData(const uint8_t *data, size_t len, const Deadline& dl = Deadline()) const {
+        if (dl.expired()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        return m_script->send(data, len);
+    }
+
+    esp_err_t recover(const Deadline& = Deadline()) const {
+        return m_script->recover();
+    }
+
+private:
+    LinkMock(const LinkMock&) = delete;
+
+    MockScript *m_script;
+};
+
+// Link that plays back a raw capture of the camera side of the bus (e.g. from a logic analyzer),
+// ignoring what is sent. Loops over the capture when it runs out.
+class LinkReplay {
+public:
+    static LinkReplay fromBuffer(std::vector<uint8_t>&& capture) {
+        return LinkReplay(std::move(capture));
+    }
+
+    static std::tuple<LinkReplay, esp_err_t> fromFile(const char *path) {
+        std::vector<uint8_t> capture;
+        FILE *f = fopen(path, "rb");
+        if (f == nullptr) {
+            return std::make_tuple(LinkReplay(std::move(capture)), ESP_ERR_NOT_FOUND);
+        }
+
+        uint8_t buf[512];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            capture.insert(capture.end(), buf, buf + n);
+        }
+        fclose(f);
+
+        if (capture.empty()) {
+            return std::make_tuple(LinkReplay(std::move(capture)), ESP_ERR_INVALID_SIZE);
+        }
+        return std::make_tuple(LinkReplay(std::move(capture)), ESP_OK);
+    }
+
+    LinkReplay(LinkReplay&& other) : m_capture(std::move(other.m_capture)), m_cursor(other.m_cursor) {}
+
+    esp_err_t receiveData(uint8_t *dest, size_t len, const Deadline& dl = Deadline()) const {
+        if (m_capture.empty() || dl.expired()) {
+            return ESP_ERR_TIMEOUT;
+        }
+
+        while (len > 0) {
+            if (m_cursor == m_capture.size()) {
+                m_cursor = 0;
+            }
+            const size_t chunk = std::min(len, m_capture.size() - m_cursor);
+            memcpy(dest, m_capture.data() + m_cursor, chunk);
+            m_cursor += chunk;
+            dest += chunk;
+            len -= chunk;
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t sendData(const uint8_t *, size_t, const Deadline& = Deadline()) const {
+        return ESP_OK;
+    }
+
+    esp_err_t recover(const Deadline& = Deadline()) const {
+        return ESP_OK;
+    }
+
+private:
+    LinkReplay(std::vector<uint8_t>&& capture) : m_capture(std::move(capture)), m_cursor(0) {}
+    LinkReplay(const LinkReplay&) = delete;
+
+    std::vector<uint8_t> m_capture;
+    mutable size_t m_cursor;
+};
+
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "acquisition.hpp"
+
+namespace pixy2 {
+
+// Several cameras: one Acquisition per camera, each polling from its own task, so the cameras
+// run in parallel (on separate buses fully, on one SPI bus interleaved per transaction).
+// FrameMerger then picks the frames that were captured closest to each other and merges
+// their blocks, tagged with the camera they came from.
+//
+//     auto front = std::get<0>(LinkSpi::addSpiDevice(HSPI_HOST, 6000000, 15)); // CS on GPIO 15
+//     auto down = std::get<0>(LinkSpi::addSpiDevice(HSPI_HOST, 6000000, 5)); // same bus, CS on GPIO 5
+//     static Acquisition<LinkSpi> frontAcq(Pixy2<LinkSpi>(std::move(front)), frontCfg);
+//     static Acquisition<LinkSpi> downAcq(Pixy2<LinkSpi>(std::move(down)), downCfg);
+//     static FrameMerger merger({ CameraSource::of(frontAcq, 1), CameraSource::of(downAcq, 1) });
+//
+// A LinkI2C camera mixes in the same way, its Acquisition<LinkI2C> can run on the other core.
+
+// Where a FrameMerger gets the frames of one camera from, usually one reader of an Acquisition.
+struct CameraSource {
+    // newest frame, or nullptr if nothing new since the last call
+    const AcquiredFrame *(*poll)(void *ctx, size_t reader);
+    void *ctx;
+    size_t reader;
+
+    template<typename LinkType, size_t Readers>
+    static CameraSource of(Acquisition<LinkType, Readers>& acq, size_t reader) {
+        CameraSource s;
+        s.poll = [](void *ctx, size_t reader) -> const AcquiredFrame* {
+            return ((Acquisition<LinkType, Readers>*)ctx)->poll(reader);
+        };
+        s.ctx = &acq;
+        s.reader = reader;
+        return s;
+    }
+};
+
+struct MergedBlock {
+    ColorBlock block;
+    // index of the CameraSource
+    uint8_t camera;
+};
+
+struct MergedFrame {
+    static constexpr const size_t MAX_CAMERAS = 4;
+    static constexpr const size_t MAX_BLOCKS = MAX_CAMERAS * AcquiredFrame::MAX_BLOCKS;
+
+    // 0 means nothing was merged yet
+    uint32_t seq = 0;
+    // capture time of the newest camera frame, the others are aligned to it
+    int64_t captureUs = 0;
+
+    uint8_t cameraCount = 0;
+    // the AcquiredFrame::seq used for each camera, 0 if the camera had nothing close enough
+    uint32_t cameraSeq[MAX_CAMERAS] = {};
+    // its captureUs minus captureUs, zero or negative
+    int32_t cameraSkewUs[MAX_CAMERAS] = {};
+
+    uint16_t blockCount = 0;
+    MergedBlock blocks[MAX_BLOCKS];
+};
+
+struct FrameMergerConfig {
+    // Frames captured further apart than this are not merged, that camera is left out.
+    // The cameras are not synchronized, a frame period (16.7 ms) apart is the best that can be
+    // had without waiting for the older camera's next frame.
+    int32_t maxSkewUs = 17000;
+};
+
+// Only ever from one task, it reads the sources' readers.
+class FrameMerger {
+public:
+    static constexpr const size_t HISTORY = 3;
+
+    template<size_t N>
+    FrameMerger(const CameraSource (&sources)[N], const FrameMergerConfig& cfg = FrameMergerConfig())
+        : m_cfg(cfg), m_count(0), m_seq(0) {
+        static_assert(N <= MergedFrame::MAX_CAMERAS, "too many cameras");
+        for(size_t i = 0; i < N; ++i) {
+            m_cameras[i].source = sources[i];
+        }
+        m_count = N;
+        m_frame.cameraCount = N;
+    }
+
+    // Collects the new camera frames and merges them if any camera had one.
+    // Returns true if frame() changed.
+    bool update() {
+        bool fresh = false;
+        bool haveNewest = false;
+        int64_t newest = 0;
+        for(size_t i = 0; i < m_count; ++i) {
+            auto& cam = m_cameras[i];
+            const AcquiredFrame *f = cam.source.poll(cam.source.ctx, cam.source.reader);
+            if(f != nullptr) {
+                cam.history[cam.head % HISTORY] = *f;
+                ++cam.head;
+                fresh = true;
+            }
+            if(cam.head != 0) {
+                const int64_t capture = cam.history[(cam.head - 1) % HISTORY].timing.captureUs;
+                if(!haveNewest || capture > newest) {
+                    newest = capture;
+                    haveNewest = true;
+                }
+            }
+        }
+        if(!fresh) {
+            return false;
+        }
+
+        m_frame.seq = ++m_seq;
+        m_frame.captureUs = newest;
+        m_frame.blockCount = 0;
+        for(size_t i = 0; i < m_count; ++i) {
+            const AcquiredFrame *best = closest(m_cameras[i], newest);
+            m_frame.cameraSeq[i] = best != nullptr ? best->seq : 0;
+            m_frame.cameraSkewUs[i] = best != nullptr ? best->timing.captureUs - newest : 0;
+            if(best == nullptr) {
+                continue;
+            }
+            for(size_t b = 0; b < best->blockCount; ++b) {
+                auto& out = m_frame.blocks[m_frame.blockCount++];
+                out.block = best->blocks[b];
+                out.camera = i;
+            }
+        }
+        return true;
+    }
+
+    // Valid until the next update().
+    const MergedFrame& frame() const { return m_frame; }
+
+private:
+    FrameMerger(const FrameMerger&) = delete;
+
+    struct Camera {
+        CameraSource source;
+        AcquiredFrame history[HISTORY];
+        uint32_t head = 0;
+    };
+
+    // The frame captured closest to captureUs, nullptr if none is within maxSkewUs.
+    const AcquiredFrame *closest(const Camera& cam, int64_t captureUs) const {
+        const AcquiredFrame *best = nullptr;
+        int64_t bestDist = 0;
+        const uint32_t count = cam.head < HISTORY ? cam.head : HISTORY;
+        for(uint32_t i = cam.head - count; i != cam.head; ++i) {
+            const AcquiredFrame& f = cam.history[i % HISTORY];
+            const int64_t dist = llabs(f.timing.captureUs - captureUs);
+            if(f.blocksErr == ESP_OK && dist <= m_cfg.maxSkewUs && (best == nullptr || dist < bestDist)) {
+                best = &f;
+                bestDist = dist;
+            }
+        }
+        return best;
+    }
+
+    FrameMergerConfig m_cfg;
+    Camera m_cameras[MergedFrame::MAX_CAMERAS];
+    size_t m_count;
+    uint32_t m_seq;
+
+    MergedFrame m_frame;
+};
+
+};
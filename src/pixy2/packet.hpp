@@ -1,23 +1,40 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
 #include <esp_err.h>
 #include <esp_log.h>
 
+#ifdef PIXY2_RESPONSE_HEAP
+#include <vector>
+#endif
+
 namespace pixy2 {
 
 static constexpr const uint8_t HDR0_CSUM = 0xAF;
 static constexpr const uint8_t HDR0_PLAIN = 0xAE;
 static constexpr const uint8_t HDR1 = 0xC1;
 
+// The Pixy answered with PacketType::ERROR
+static constexpr const esp_err_t ERR_PIXY_BUSY = 0x10;
+// The link failed too many times in a row, calls fail right away until a probe gets through
+static constexpr const esp_err_t ERR_PIXY_LINK_DOWN = 0x11;
+
 template<typename T> class Pixy2;
 class Pixy2_I2C;
+class PacketParser;
 
 enum PacketType : uint8_t {
+    RESULT = 0x01,
     ERROR = 0x03,
+    GET_RESOLUTION = 0x0C,
+    GET_RESOLUTION_RESPONSE = 0x0D,
     GET_VERSION = 0x0E,
     GET_VERSION_RESPONSE = 0x0F,
+    SET_LAMP = 0x16,
+    GET_FPS = 0x18,
     GET_BLOCKS = 0x20,
     GET_BLOCKS_RESPONSE = 0x21,
 
@@ -25,30 +42,26 @@ enum PacketType : uint8_t {
     GET_LINE_FEATURES_RESPONSE = 0x31,
 };
 
+template<PacketType Request, PacketType Response, typename Element, size_t Args> struct PacketSchema;
+
+// Literal type, so requests with known arguments can be constexpr and live in flash.
 template<size_t N>
 class PacketRequest {
     template<typename T> friend class Pixy2;
     friend class Pixy2_I2C;
-public:
-    ~PacketRequest() {}
+    template<PacketType Request, PacketType Response, typename Element, size_t Args> friend struct PacketSchema;
 
 private:
     template<typename T>
-    PacketRequest(PacketType type, T const (&bytes)[N]) {
-        m_raw[0] = HDR0_PLAIN;
-        m_raw[1] = HDR1;
-        m_raw[2] = type;
-        m_raw[3] = N;
+    constexpr PacketRequest(PacketType type, T const (&bytes)[N]) : m_raw{ HDR0_PLAIN, HDR1, uint8_t(type), uint8_t(N) } {
         for(size_t i = 0; i < N; ++i) {
             m_raw[4 + i] = bytes[i];
         }
     }
 
-    PacketRequest(PacketType type) {
-        m_raw[0] = HDR0_PLAIN;
-        m_raw[1] = HDR1;
-        m_raw[2] = type;
-        m_raw[3] = 0;
+    template<typename... T>
+    constexpr PacketRequest(PacketType type, T... bytes) : m_raw{ HDR0_PLAIN, HDR1, uint8_t(type), uint8_t(N), uint8_t(bytes)... } {
+        static_assert(sizeof...(T) == N, "wrong number of request bytes");
     }
 
     static constexpr size_t rawSize() { return 4 + N; }
@@ -56,9 +69,45 @@ private:
     uint8_t m_raw[rawSize()];
 };
 
+// Header with checksum + the most a uint8_t length can describe
+static constexpr const size_t MAX_PACKET_SIZE = 6 + 255;
+
+#ifdef PIXY2_RESPONSE_HEAP
+typedef std::vector<uint8_t> ResponseBuffer;
+#else
+// Fixed-capacity replacement of std::vector<uint8_t>, so receiving a packet never touches the heap.
+// Define PIXY2_RESPONSE_HEAP to get the old vector back, e.g. to save RAM when many contexts exist.
+class ResponseBuffer {
+public:
+    ResponseBuffer() : m_size(0) {}
+
+    size_t size() const { return m_size; }
+    static constexpr size_t capacity() { return MAX_PACKET_SIZE; }
+
+    void resize(size_t size) {
+        if(size > capacity()) {
+            ESP_LOGE("pixy2", "attempted to resize response to %u, but capacity is %u.", unsigned(size), unsigned(capacity()));
+            abort();
+        }
+        m_size = size;
+    }
+
+    uint8_t *data() { return m_data; }
+    const uint8_t *data() const { return m_data; }
+
+    uint8_t& operator[](size_t idx) { return m_data[idx]; }
+    uint8_t operator[](size_t idx) const { return m_data[idx]; }
+
+private:
+    uint8_t m_data[MAX_PACKET_SIZE];
+    size_t m_size;
+};
+#endif
+
 class PacketResponse {
     template<typename T> friend class Pixy2;
     friend class Pixy2_I2C;
+    friend class PacketParser;
 public:
     PacketResponse() {}
     ~PacketResponse() {}
@@ -75,42 +124,45 @@ public:
         return PacketType(m_raw[2]);
     }
 
+    // esp_timer_get_time() right before the request was sent and after the response was received
+    int64_t requestUs() const { return m_requestUs; }
+    int64_t responseUs() const { return m_responseUs; }
+
+    // The whole packet, header included, as received. After a failed receive only the part
+    // of it that arrived.
+    const uint8_t *raw() const { return m_raw.data(); }
+    size_t rawSize() const { return m_raw.size(); }
+
     // without header
     const uint8_t *data() const {
         return m_raw.data() + headerSize();
     }
 
+    // Copies a T from the data at idx. Goes through memcpy, the data has no alignment guarantees.
     template<typename T>
-    T get(uint8_t idx) {
-        size_t end = headerSize() + idx + sizeof(T);
+    esp_err_t read(size_t idx, T& dest) const {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain data can be read from a packet");
+        const size_t end = headerSize() + idx + sizeof(T);
         if(end > m_raw.size()) {
-            ESP_LOGE("pixy2", "attempted to read until %d, but only have %d bytes.", end, m_raw.size());
-            return T();
+            return ESP_ERR_INVALID_SIZE;
         }
-        return *((T*)(m_raw.data() + headerSize() + idx));
+        memcpy(&dest, m_raw.data() + headerSize() + idx, sizeof(T));
+        return ESP_OK;
     }
 
-private:
-    esp_err_t checkCsum() const {
-        if(m_raw[0] != HDR0_CSUM) {
-            return ESP_OK;
-        }
-
-        const uint16_t expectedCsum = m_raw[4] | (m_raw[5] << 8);
-        uint16_t calculatedCsum = 0;
-        for(size_t i = 6; i < m_raw.size(); ++i) {
-            calculatedCsum += m_raw[i];
-        }
-
-        if (expectedCsum != calculatedCsum)
-        {
-            ESP_LOGE("pixy2", "checksums don't match: %04x != %04x", calculatedCsum, expectedCsum);
-            return ESP_ERR_INVALID_CRC;
+    template<typename T>
+    T get(uint8_t idx) const {
+        T result = T();
+        if(read(idx, result) != ESP_OK) {
+            ESP_LOGE("pixy2", "attempted to read until %u, but only have %u bytes.", unsigned(headerSize() + idx + sizeof(T)), unsigned(m_raw.size()));
         }
-        return ESP_OK;
+        return result;
     }
 
-    std::vector<uint8_t> m_raw;
+private:
+    ResponseBuffer m_raw;
+    int64_t m_requestUs = 0;
+    int64_t m_responseUs = 0;
 };
 
 struct ColorBlock {
@@ -121,6 +173,16 @@ struct ColorBlock {
     uint8_t age;
 } __attribute__((packed));
 
+// Answer to requests which only report success, negative is an error
+struct ResultResponse {
+    int32_t result;
+} __attribute__((packed));
+
+struct ResolutionResponse {
+    uint16_t width;
+    uint16_t height;
+} __attribute__((packed));
+
 struct VersionResponse {
     uint16_t hw_version;
     uint8_t fw_version_major;
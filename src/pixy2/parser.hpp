@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+
+#include "../trace.hpp"
+#include "packet.hpp"
+#include "schema.hpp"
+
+namespace pixy2 {
+
+// Push-based packet parser, independent of where the bytes come from (a link, a DMA buffer,
+// a replay file...). It finds the sync word, reads the header and payload and sums
+// the checksum as the bytes come in. The packet is assembled straight into a PacketResponse.
+//
+// Bytes can be pushed with feed(), or written in place: buffer() tells where and how many,
+// commit() processes them.
+class PacketParser {
+public:
+    explicit PacketParser(PacketResponse& dest) : m_resp(dest) {
+        reset();
+    }
+
+    void reset() {
+        m_resp.m_raw.resize(MAX_PACKET_SIZE);
+        m_state = SYNC;
+        m_have = 0;
+        m_total = 0;
+        m_summed = 0;
+        m_csum = 0;
+        m_skipped = 0;
+        m_result = ESP_ERR_INVALID_STATE;
+    }
+
+    // Where to write up to space more bytes. Only valid until the packet is complete.
+    uint8_t *buffer(size_t& space) {
+        space = MAX_PACKET_SIZE - m_have;
+        return m_resp.m_raw.data() + m_have;
+    }
+
+    // Process n bytes written to buffer(). Returns how many of them belong to the packet
+    // or were skipped before it, the rest (past the end of the packet) is ignored.
+    size_t commit(size_t n) {
+        const size_t start = m_have;
+        m_have += n;
+        size_t consumed = n;
+
+        if (m_state == SYNC) {
+            findSync(start);
+        }
+        if (m_state != SYNC && m_state != DONE) {
+            consumed = advance(n);
+        }
+        return consumed;
+    }
+
+    // Copy-in variant of buffer/commit. Returns the number of bytes consumed, which is less
+    // than len if the packet completed before the end of data.
+    size_t feed(const uint8_t *data, size_t len) {
+        size_t consumed = 0;
+        while (consumed < len && !complete()) {
+            size_t space;
+            uint8_t *dst = buffer(space);
+            const size_t chunk = std::min(space, len - consumed);
+            memcpy(dst, data + consumed, chunk);
+            consumed += commit(chunk);
+        }
+        return consumed;
+    }
+
+    bool syncing() const { return m_state == SYNC; }
+    bool complete() const { return m_state == DONE; }
+
+    // ESP_OK or ESP_ERR_INVALID_CRC once complete
+    esp_err_t result() const { return m_result; }
+
+    // bytes dropped while looking for the sync word
+    size_t skipped() const { return m_skipped; }
+
+    // How many more bytes are needed at least. While syncing, at least a whole header.
+    size_t missing() const {
+        switch (m_state) {
+        case SYNC:
+            return 6;
+        case HEADER:
+            return headerSize() - m_have;
+        case DATA:
+            return m_total - m_have;
+        default:
+            return 0;
+        }
+    }
+
+    PacketResponse& response() { return m_resp; }
+
+    // For a packet that will not be completed: cuts the response down to what arrived
+    // of it, so it does not look like a full buffer of data.
+    void abandon() {
+        if (m_state != DONE) {
+            m_resp.m_raw.resize(m_have);
+        }
+    }
+
+private:
+    enum State : uint8_t {
+        SYNC,
+        HEADER,
+        DATA,
+        DONE,
+    };
+
+    size_t headerSize() const { return m_resp.m_raw[0] == HDR0_CSUM ? 6 : 4; }
+
+    void findSync(size_t start) {
+        auto& raw = m_resp.m_raw;
+        for (size_t i = std::max(start, size_t(1)); i < m_have; ++i) {
+            if (raw[i] == HDR1 && (raw[i - 1] == HDR0_PLAIN || raw[i - 1] == HDR0_CSUM)) {
+                const size_t syncAt = i - 1;
+                memmove(raw.data(), raw.data() + syncAt, m_have - syncAt);
+                m_have -= syncAt;
+                m_skipped += syncAt;
+                m_state = HEADER;
+                return;
+            }
+        }
+
+        // Keep the last byte, it might be HDR0 of a sync word split between two chunks.
+        if (m_have > 1) {
+            m_skipped += m_have - 1;
+            raw[0] = raw[m_have - 1];
+            m_have = 1;
+        }
+    }
+
+    // Returns how many of the n new bytes (ending at m_have) were used.
+    size_t advance(size_t n) {
+        auto& raw = m_resp.m_raw;
+        if (m_state == HEADER) {
+            const size_t hdrSize = headerSize();
+            if (m_have < hdrSize) {
+                return n;
+            }
+            m_total = hdrSize + raw[3];
+            m_summed = hdrSize;
+            m_state = DATA;
+        }
+
+        const size_t end = std::min(m_have, m_total);
+        for (; m_summed < end; ++m_summed) {
+            m_csum += raw[m_summed];
+        }
+
+        if (m_have < m_total) {
+            return n;
+        }
+
+        // whatever came after the end of the packet is not ours
+        const size_t extra = m_have - m_total;
+        m_have = m_total;
+        raw.resize(m_total);
+        m_state = DONE;
+        m_result = checkCsum();
+        return n > extra ? n - extra : 0;
+    }
+
+    esp_err_t checkCsum() const {
+        const auto& raw = m_resp.m_raw;
+        if (raw[0] != HDR0_CSUM) {
+            return ESP_OK;
+        }
+
+        const uint16_t expectedCsum = raw[4] | (raw[5] << 8);
+        if (expectedCsum != m_csum) {
+            ESP_LOGE("pixy2", "checksums don't match: %04x != %04x", m_csum, expectedCsum);
+            TRACE(PIXY_CSUM_FAIL, uint32_t(m_csum) << 16 | expectedCsum);
+            return ESP_ERR_INVALID_CRC;
+        }
+        return ESP_OK;
+    }
+
+    PacketResponse& m_resp;
+    State m_state;
+    size_t m_have;
+    size_t m_total;
+    size_t m_summed;
+    uint16_t m_csum;
+    size_t m_skipped;
+    esp_err_t m_result;
+};
+
+};
@@ -1,21 +1,39 @@
 #pragma once
 
-#include <driver/spi_master.h>
+#include <algorithm>
+#include <atomic>
+#include <esp_err.h>
 #include <mutex>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <esp_timer.h>
 #include <tuple>
 
+#include "../trace.hpp"
+#include "deadline.hpp"
 #include "packet.hpp"
+#include "parser.hpp"
 #include "pixy_span.hpp"
+#include "schema.hpp"
 
 namespace pixy2 {
 
+struct FrameTiming {
+    // esp_timer_get_time() when the request was sent and when the response was complete
+    int64_t requestUs = 0;
+    int64_t responseUs = 0;
+    // estimate of when the camera captured the image the response describes, see Pixy2::setCaptureLatency
+    int64_t captureUs = 0;
+};
 
-
+// The contexts hold a whole response buffer inline (see ResponseBuffer), so keep them
+// around between calls instead of creating them on small task stacks.
 struct GetBlocksContext {
     // Blocks are valid while this GetBlocksContext lives and until next getColorBlocks call,
     // otherwise you need to make a copy.
     PixySpan<ColorBlock> blocks;
+    FrameTiming timing;
 
     PacketResponse resp;
 };
@@ -26,136 +44,513 @@ struct LineFeaturesContext {
     PixySpan<LineVector> vectors;
     PixySpan<LineIntersection> intersections;
     PixySpan<LineBarCode> barcodes;
+    FrameTiming timing;
 
     PacketResponse resp;
 };
 
+// What Pixy2::getFrame fetches. All of it is done back to back under one lock, in this order:
+// lamp, blocks for every non-zero signature mask, line features, version, resolution.
+struct FrameQuery {
+    static constexpr const size_t MAX_BLOCK_QUERIES = 2;
+
+    // 0 leaves the slot unused
+    uint8_t signaturesMasks[MAX_BLOCK_QUERIES] = { 0xFF, 0 };
+    uint8_t maxBlocks = 255 / sizeof(ColorBlock);
+
+    bool lineFeatures = false;
+    LineFeatures features = LineFeatures::ALL;
+    bool allFeatures = false;
+
+    bool setLamp = false;
+    bool upperLamp = false;
+    bool lowerLamp = false;
+
+    bool version = false;
+    bool resolution = false;
+};
+
+// Results of one Pixy2::getFrame. Parts which were not asked for have ESP_ERR_INVALID_STATE.
+// Big, keep it around between calls.
+struct FrameContext {
+    GetBlocksContext blocks[FrameQuery::MAX_BLOCK_QUERIES];
+    esp_err_t blocksErr[FrameQuery::MAX_BLOCK_QUERIES];
+
+    LineFeaturesContext lines;
+    esp_err_t linesErr;
+
+    VersionResponse version;
+    esp_err_t versionErr;
+
+    ResolutionResponse resolution;
+    esp_err_t resolutionErr;
+
+    esp_err_t lampErr;
+
+    // requestUs and captureUs of the first request, responseUs of the last response
+    FrameTiming timing;
+
+    // for the responses which are copied out
+    PacketResponse scratch;
+};
+
+// Sees every finished transaction, e.g. FlightRecorder::pixyHook. Called with the link locked,
+// so keep it short. The response may be incomplete if err is not ESP_OK.
+typedef void (*TransactionHook)(const uint8_t *request, size_t requestLen, const PacketResponse& response, esp_err_t err, void *ctx);
+
+#ifdef PIXY2_STATS
+// Per-instance counters, only compiled in with -DPIXY2_STATS (used by the bench/ target).
+struct Pixy2Stats {
+    uint32_t transactions = 0;
+    uint32_t syncBytesSkipped = 0;
+    int64_t syncTimeUs = 0;
+    // transactions given up at their deadline, and link recoveries that got through
+    uint32_t deadlineMisses = 0;
+    uint32_t recoveries = 0;
+    int64_t transactTimeUs = 0;
+};
+#endif
+
+// Every call that touches the bus takes a Deadline, by default callBudget() from the start of
+// the call. Waiting for the link, each read and write and the bus timeouts all count against it,
+// so a call returns ESP_ERR_TIMEOUT at most a tick or one bus command (bounded by the deadline
+// too on I2C) after it, with the link unlocked.
+//
+// After failLimit failed transactions in a row the link is considered down: calls fail right
+// away with ERR_PIXY_LINK_DOWN, without touching the bus. Once every probe interval, the
+// caller that comes along resets the link (LinkType::recover) and probes it with a version
+// request, within its own deadline. If that gets through, the call goes on as usual.
 template<typename LinkType>
 class Pixy2 {
 public:
-    static constexpr const esp_err_t ERR_PIXY_BUSY = 0x10;
+    static constexpr const esp_err_t ERR_PIXY_BUSY = pixy2::ERR_PIXY_BUSY;
+    static constexpr const esp_err_t ERR_PIXY_LINK_DOWN = pixy2::ERR_PIXY_LINK_DOWN;
 
-    Pixy2(LinkType&& link): m_link(std::move(link)) {
+    // Pixy2 at 60 fps: the answer is about one frame of processing plus half a frame of waiting old.
+    static constexpr const int64_t DEFAULT_CAPTURE_LATENCY_US = 25000;
+
+    // A full 255 byte response takes about 6 ms on I2C at 400 kHz, well under 1 ms on SPI.
+    static constexpr const int64_t DEFAULT_CALL_BUDGET_US = 30000;
+    static constexpr const uint8_t DEFAULT_FAIL_LIMIT = 3;
+    static constexpr const int64_t DEFAULT_PROBE_INTERVAL_US = 100000;
+
+    Pixy2(LinkType&& link): m_link(std::move(link)), m_captureLatencyUs(DEFAULT_CAPTURE_LATENCY_US),
+        m_callBudgetUs(DEFAULT_CALL_BUDGET_US), m_failLimit(DEFAULT_FAIL_LIMIT), m_probeIntervalUs(DEFAULT_PROBE_INTERVAL_US),
+        m_hook(nullptr), m_hookCtx(nullptr), m_failures(0), m_down(false), m_nextProbeUs(0),
+        m_asyncRequestUs(0), m_asyncRequestLen(0) {
 
     }
 
-    Pixy2(Pixy2&& other): m_link(std::move(other.m_link)) {
+    Pixy2(Pixy2&& other): m_link(std::move(other.m_link)), m_captureLatencyUs(other.m_captureLatencyUs),
+        m_callBudgetUs(other.m_callBudgetUs), m_failLimit(other.m_failLimit), m_probeIntervalUs(other.m_probeIntervalUs),
+        m_hook(other.m_hook), m_hookCtx(other.m_hookCtx), m_failures(0), m_down(false), m_nextProbeUs(0),
+        m_asyncRequestUs(0), m_asyncRequestLen(0) {
 
     }
     ~Pixy2() { }
 
+    // Retries getVersion until it answers, each try within callBudget() and all within timeout.
     esp_err_t waitForStartup(VersionResponse *captureVersion = nullptr, TickType_t timeout = pdMS_TO_TICKS(5000)) const;
-    esp_err_t getVersion(VersionResponse& dest) const;
+    esp_err_t getVersion(VersionResponse& dest, const Deadline& dl = Deadline::budget()) const;
+    esp_err_t getResolution(ResolutionResponse& dest, const Deadline& dl = Deadline::budget()) const;
+    // Current frame rate, it drops in low light.
+    esp_err_t getFPS(uint32_t& fps, const Deadline& dl = Deadline::budget()) const;
+
+    esp_err_t getColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx,
+        const Deadline& dl = Deadline::budget()) const;
 
-    esp_err_t getColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx) const;
+    esp_err_t getLineFeatures(LineFeaturesContext& ctx, LineFeatures features = LineFeatures::ALL, bool allFeatures = false,
+        const Deadline& dl = Deadline::budget()) const;
 
-    esp_err_t getLineFeatures(LineFeaturesContext& ctx, LineFeatures features = LineFeatures::ALL, bool allFeatures = false) const;
+    esp_err_t setLamp(bool upper, bool lower, const Deadline& dl = Deadline::budget()) const;
+
+    // Runs everything the query asks for in one locked session, without giving the link
+    // to other tasks in between. Returns the first error, the per-part ones are in ctx.
+    // The deadline is for the whole session, parts past it fail with ESP_ERR_TIMEOUT.
+    esp_err_t getFrame(const FrameQuery& query, FrameContext& ctx, const Deadline& dl = Deadline::budget()) const;
 
     template<typename T, size_t N>
-    static PacketRequest<N> request(PacketType type, T const (&bytes)[N]) {
+    static constexpr PacketRequest<N> request(PacketType type, T const (&bytes)[N]) {
         return PacketRequest<N>(type, bytes);
     }
 
-    static PacketRequest<0> request(PacketType type) {
+    static constexpr PacketRequest<0> request(PacketType type) {
         return PacketRequest<0>(type);
     }
 
+    // expectedDataLen is how many data bytes the response likely has, they are read
+    // together with the header. Too much just costs bus time, too little costs an extra read.
     template<size_t N>
-    esp_err_t transact(const PacketRequest<N>& request, PacketResponse& response) const {
-        return transact(request.m_raw, request.rawSize(), response);
+    esp_err_t transact(const PacketRequest<N>& request, PacketResponse& response, size_t expectedDataLen = 0,
+        const Deadline& dl = Deadline::budget()) const {
+        return transact(request.m_raw, request.rawSize(), response, expectedDataLen, dl);
     }
 
+    // Async variant of transact, LinkSpi::addSpiDeviceAsync only. submit queues the request
+    // and a read of the expected response and returns right away, collect waits for it and
+    // finishes the packet. The link stays locked in between, so every successful submit
+    // has to be followed by a collect from the same task. Each has its own deadline, except
+    // that a collect that gives up still waits for the queued transfers to end.
+    template<size_t N>
+    esp_err_t submit(const PacketRequest<N>& request, size_t expectedDataLen = 0, const Deadline& dl = Deadline::budget()) const {
+        return submit(request.m_raw, request.rawSize(), expectedDataLen, dl);
+    }
+    esp_err_t collect(PacketResponse& response, const Deadline& dl = Deadline::budget()) const;
+
+    esp_err_t submitColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, const Deadline& dl = Deadline::budget()) const;
+    esp_err_t collectColorBlocks(GetBlocksContext& ctx, const Deadline& dl = Deadline::budget()) const;
+
+    // How much older than the request the captured image is, used for FrameTiming::captureUs.
+    // Measure it for your setup, e.g. by filming a blinking LED.
+    void setCaptureLatency(int64_t us) { m_captureLatencyUs = us; }
+    int64_t captureLatency() const { return m_captureLatencyUs; }
+
+    // Set it before the Pixy2 is used from other tasks, nullptr to turn it off.
+    void setTransactionHook(TransactionHook hook, void *ctx) {
+        m_hook = hook;
+        m_hookCtx = ctx;
+    }
+
+    // The default deadline of every call, 0 for none. Set these before the Pixy2 is used from other tasks.
+    void setCallBudget(int64_t us) { m_callBudgetUs = us; }
+    int64_t callBudget() const { return m_callBudgetUs; }
+
+    // failLimit 0 never takes the link down.
+    void setRecovery(uint8_t failLimit, int64_t probeIntervalUs) {
+        m_failLimit = failLimit;
+        m_probeIntervalUs = probeIntervalUs;
+    }
+    bool linkDown() const { return m_down; }
+
+#ifdef PIXY2_STATS
+    const Pixy2Stats& stats() const { return m_stats; }
+    void resetStats() { m_stats = Pixy2Stats(); }
+#endif
+
 private:
     Pixy2(const Pixy2&) = delete;
 
-    esp_err_t transact(const uint8_t *reqData, size_t reqLen, PacketResponse& response) const;
+    // Holds m_linkMutex, unless the deadline passed while waiting for it.
+    class LinkLock {
+    public:
+        LinkLock(const Pixy2& pixy, const Deadline& dl) : m_pixy(pixy), m_locked(pixy.lockLink(dl)) {}
+        ~LinkLock() {
+            if(m_locked) {
+                m_pixy.m_linkMutex.unlock();
+            }
+        }
+        bool locked() const { return m_locked; }
+
+    private:
+        const Pixy2& m_pixy;
+        const bool m_locked;
+    };
 
-    esp_err_t waitForSyncLocked(PacketResponse& resp, uint16_t attempts = 64) const;
-    esp_err_t receivePacketLocked(PacketResponse& resp) const;
+    Deadline resolve(const Deadline& dl) const {
+        if(!dl.isBudget()) {
+            return dl;
+        }
+        return m_callBudgetUs > 0 ? Deadline::in(m_callBudgetUs) : Deadline::never();
+    }
+
+    // The other holders are bounded by their own deadlines, so without one this just waits.
+    bool lockLink(const Deadline& dl) const {
+        if(!dl.bounded()) {
+            m_linkMutex.lock();
+            return true;
+        }
+        while(!m_linkMutex.try_lock()) {
+            if(dl.expired()) {
+                return false;
+            }
+            vTaskDelay(1);
+        }
+        return true;
+    }
+
+    esp_err_t transact(const uint8_t *reqData, size_t reqLen, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const {
+        const Deadline d = resolve(dl);
+        LinkLock l(*this, d);
+        if(!l.locked()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        return transactLocked(reqData, reqLen, response, expectedDataLen, d);
+    }
+    template<size_t N>
+    esp_err_t transactLocked(const PacketRequest<N>& request, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const {
+        return transactLocked(request.m_raw, request.rawSize(), response, expectedDataLen, dl);
+    }
+    // Recovers the link first if it is down, and counts the failures.
+    esp_err_t transactLocked(const uint8_t *reqData, size_t reqLen, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const;
+    // Just the bus part.
+    esp_err_t exchangeLocked(const uint8_t *reqData, size_t reqLen, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const;
+
+    esp_err_t recoverLocked(const Deadline& dl) const;
+    esp_err_t noteResultLocked(esp_err_t err) const;
+
+    esp_err_t getVersionLocked(PacketResponse& resp, VersionResponse& dest, const Deadline& dl) const;
+    esp_err_t getResolutionLocked(PacketResponse& resp, ResolutionResponse& dest, const Deadline& dl) const;
+    esp_err_t getColorBlocksLocked(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx, const Deadline& dl) const;
+    esp_err_t getLineFeaturesLocked(LineFeaturesContext& ctx, LineFeatures features, bool allFeatures, const Deadline& dl) const;
+    esp_err_t setLampLocked(PacketResponse& resp, bool upper, bool lower, const Deadline& dl) const;
+
+    esp_err_t submit(const uint8_t *reqData, size_t reqLen, size_t expectedDataLen, const Deadline& dl) const;
+
+    esp_err_t receivePacketLocked(PacketResponse& resp, size_t expectedDataLen, const Deadline& dl,
+        const uint8_t *prefetched = nullptr, size_t prefetchedLen = 0, uint16_t attempts = 64) const;
+
+    FrameTiming timingOf(const PacketResponse& resp) const {
+        FrameTiming t;
+        t.requestUs = resp.requestUs();
+        t.responseUs = resp.responseUs();
+        t.captureUs = t.requestUs - m_captureLatencyUs;
+        return t;
+    }
 
     esp_err_t getLineFeatures();
 
     mutable std::mutex m_linkMutex;
     LinkType m_link;
+
+    int64_t m_captureLatencyUs;
+    int64_t m_callBudgetUs;
+    uint8_t m_failLimit;
+    int64_t m_probeIntervalUs;
+
+    TransactionHook m_hook;
+    void *m_hookCtx;
+
+    // link health, only touched with the link locked
+    mutable uint8_t m_failures;
+    mutable std::atomic<bool> m_down;
+    mutable int64_t m_nextProbeUs;
+
+    mutable int64_t m_asyncRequestUs;
+    // for the hook, the request of the transfer in flight
+    mutable uint8_t m_asyncRequest[8];
+    mutable uint8_t m_asyncRequestLen;
+
+#ifdef PIXY2_STATS
+    mutable Pixy2Stats m_stats;
+#endif
 };
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::waitForSyncLocked(PacketResponse& resp, uint16_t attempts) const {
-    uint8_t current, prev = 0;
-    for (size_t i = 0; i < attempts; ++i)
+esp_err_t Pixy2<LinkType>::receivePacketLocked(PacketResponse& resp, size_t expectedDataLen, const Deadline& dl,
+    const uint8_t *prefetched, size_t prefetchedLen, uint16_t attempts) const {
+    PacketParser parser(resp);
+
+    // Bytes already read by an async transfer go first.
+    if (prefetchedLen > 0)
+    {
+        parser.feed(prefetched, prefetchedLen);
+    }
+
+    // Read whole blocks instead of single bytes, every receiveData is a full bus transaction.
+    // First block is the whole expected response, if the Pixy was not ready yet,
+    // continue with header-sized blocks. Anything read past the end of the packet is dropped.
+    size_t readAhead = prefetchedLen > 0 ? 0 : 6 + expectedDataLen;
+    // attempts counts bytes skipped after the first block, which may be all zeros when the Pixy was not ready
+    const size_t skipLimit = attempts + (prefetchedLen > 0 ? prefetchedLen : readAhead);
+    while (!parser.complete())
     {
-        auto err = m_link.receiveData(&current, 1);
+        if (parser.syncing() && parser.skipped() >= skipLimit)
+        {
+            TRACE(PIXY_SYNC_SKIPPED, parser.skipped());
+            parser.abandon();
+            return ESP_ERR_TIMEOUT;
+        }
+        if (dl.expired())
+        {
+#ifdef PIXY2_STATS
+            ++m_stats.deadlineMisses;
+#endif
+            parser.abandon();
+            return ESP_ERR_TIMEOUT;
+        }
+
+#ifdef PIXY2_STATS
+        const int64_t start = esp_timer_get_time();
+        const bool wasSyncing = parser.syncing();
+#endif
+
+        size_t space;
+        uint8_t *dest = parser.buffer(space);
+        const size_t chunk = std::min(std::max(readAhead, parser.missing()), space);
+        readAhead = 0;
+
+        auto err = m_link.receiveData(dest, chunk, dl);
         if (err != ESP_OK)
         {
+            parser.abandon();
             return err;
         }
+        parser.commit(chunk);
 
-        if (current == HDR1 && (prev == HDR0_PLAIN || prev == HDR0_CSUM))
+#ifdef PIXY2_STATS
+        if (wasSyncing)
         {
-            resp.m_raw = { prev, current };
-            return ESP_OK;
+            m_stats.syncTimeUs += esp_timer_get_time() - start;
         }
-        prev = current;
+#endif
     }
-    return ESP_ERR_TIMEOUT;
+
+#ifdef PIXY2_STATS
+    m_stats.syncBytesSkipped += parser.skipped();
+#endif
+    if (parser.skipped() > 0)
+    {
+        TRACE(PIXY_SYNC_SKIPPED, parser.skipped());
+    }
+
+    return parser.result();
 }
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::receivePacketLocked(PacketResponse& resp) const {
-    auto err = waitForSyncLocked(resp);
-    if (err != ESP_OK)
-    {
+esp_err_t Pixy2<LinkType>::transactLocked(const uint8_t *reqData, size_t reqLen, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const {
+    // Not started is not the link's fault, e.g. the rest of a getFrame past its deadline.
+    esp_err_t err = dl.expired() ? ESP_ERR_TIMEOUT : ESP_OK;
+    if(err == ESP_OK && m_down) {
+        err = recoverLocked(dl);
+    }
+    if(err != ESP_OK) {
+        response.m_requestUs = response.m_responseUs = esp_timer_get_time();
         return err;
     }
+    return noteResultLocked(exchangeLocked(reqData, reqLen, response, expectedDataLen, dl));
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::exchangeLocked(const uint8_t *reqData, size_t reqLen, PacketResponse& response, size_t expectedDataLen, const Deadline& dl) const {
+    TRACE_SCOPE(traceScope, HIST_PIXY_TRANSACT, PIXY_TRANSACT_BEGIN, PIXY_TRANSACT_END, reqLen > 2 ? reqData[2] : 0);
+
+#ifdef PIXY2_STATS
+    const int64_t start = esp_timer_get_time();
+    ++m_stats.transactions;
+#endif
+
+    // nothing received until the parser says otherwise, e.g. if sending fails
+    response.m_raw.resize(0);
+    response.m_requestUs = esp_timer_get_time();
+    auto err = m_link.sendData(reqData, reqLen, dl);
+    if(err == ESP_OK) {
+        err = receivePacketLocked(response, expectedDataLen, dl);
+    }
+    response.m_responseUs = esp_timer_get_time();
+    TRACE_SCOPE_RESULT(traceScope, err);
+    if(m_hook != nullptr) {
+        m_hook(reqData, reqLen, response, err, m_hookCtx);
+    }
 
-    auto& raw = resp.m_raw;
-    const auto hdrSize = resp.headerSize();
+#ifdef PIXY2_STATS
+    m_stats.transactTimeUs += esp_timer_get_time() - start;
+#endif
+    return err;
+}
 
-    raw.resize(hdrSize);
-    err = m_link.receiveData(raw.data() + 2,  hdrSize - 2);
-    if (err != ESP_OK)
-    {
-        return err;
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::recoverLocked(const Deadline& dl) const {
+    const int64_t now = esp_timer_get_time();
+    if(now < m_nextProbeUs) {
+        return ERR_PIXY_LINK_DOWN;
     }
+    m_nextProbeUs = now + m_probeIntervalUs;
 
-    if (resp.dataLen() > 0)
-    {
-        raw.resize(hdrSize + resp.dataLen());
-        err = m_link.receiveData(raw.data() + hdrSize, resp.dataLen());
-        if (err != ESP_OK)
-        {
-            return err;
+    auto err = m_link.recover(dl);
+    if(err == ESP_OK) {
+        PacketResponse probe;
+        VersionResponse version;
+        err = exchangeLocked(VERSION_REQUEST.m_raw, VERSION_REQUEST.rawSize(), probe, sizeof(VersionResponse), dl);
+        if(err == ESP_OK) {
+            err = decode<VersionSchema>(probe, version);
         }
     }
+    if(err != ESP_OK) {
+        return ERR_PIXY_LINK_DOWN;
+    }
+
+    ESP_LOGI("Pixy2", "link is back");
+    m_failures = 0;
+    m_down = false;
+#ifdef PIXY2_STATS
+    ++m_stats.recoveries;
+#endif
+    return ESP_OK;
+}
 
-    return resp.checkCsum();
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::noteResultLocked(esp_err_t err) const {
+    if(err == ESP_OK) {
+        m_failures = 0;
+    } else if(m_failLimit != 0 && !m_down && ++m_failures >= m_failLimit) {
+        ESP_LOGW("Pixy2", "link down after %u failures, last %d", m_failures, err);
+        m_down = true;
+        m_nextProbeUs = esp_timer_get_time() + m_probeIntervalUs;
+    }
+    return err;
 }
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::transact(const uint8_t *reqData, size_t reqLen, PacketResponse& response) const {
-    std::lock_guard<std::mutex> l(m_linkMutex);
+esp_err_t Pixy2<LinkType>::submit(const uint8_t *reqData, size_t reqLen, size_t expectedDataLen, const Deadline& dl) const {
+    const Deadline d = resolve(dl);
+    if(!lockLink(d)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if(m_down) {
+        auto err = recoverLocked(d);
+        if(err != ESP_OK) {
+            m_linkMutex.unlock();
+            return err;
+        }
+    }
 
-    auto err = m_link.sendData(reqData, reqLen);
+    m_asyncRequestLen = std::min(reqLen, sizeof(m_asyncRequest));
+    memcpy(m_asyncRequest, reqData, m_asyncRequestLen);
+    m_asyncRequestUs = esp_timer_get_time();
+    auto err = m_link.queueTransfer(reqData, reqLen, std::min(6 + expectedDataLen, LinkType::ASYNC_BUFFER_SIZE));
     if(err != ESP_OK) {
-        return err;
+        m_linkMutex.unlock();
     }
+    return err;
+}
 
-    return receivePacketLocked(response);
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::collect(PacketResponse& response, const Deadline& dl) const {
+    std::lock_guard<std::mutex> l(m_linkMutex, std::adopt_lock);
+    const Deadline d = resolve(dl);
+
+    const uint8_t *rx = nullptr;
+    size_t rxLen = 0;
+    response.m_raw.resize(0);
+    auto err = m_link.collectTransfer(&rx, &rxLen, d.ticks(portMAX_DELAY));
+    if(err == ESP_OK) {
+        // If the Pixy was slower than expected or the packet is bigger, the rest is read synchronously.
+        err = receivePacketLocked(response, 0, d, rx, rxLen);
+    } else {
+        // The transfers are still queued and have to be waited out before anything else uses
+        // the link, past the deadline if need be. They end on their own, the master clocks them.
+        m_link.recover();
+    }
+    response.m_requestUs = m_asyncRequestUs;
+    response.m_responseUs = esp_timer_get_time();
+    if(m_hook != nullptr) {
+        m_hook(m_asyncRequest, m_asyncRequestLen, response, err, m_hookCtx);
+    }
+    return noteResultLocked(err);
 }
 
 template<typename LinkType>
 esp_err_t Pixy2<LinkType>::waitForStartup(VersionResponse *captureVersion, TickType_t timeout) const {
     VersionResponse version;
-    const auto start = xTaskGetTickCount();
-    const auto timeoutAt = start + timeout;
-    while (xTaskGetTickCount() < timeoutAt) {
-        auto err = getVersion(version);
+    const auto total = Deadline::in(int64_t(timeout) * portTICK_PERIOD_MS * 1000);
+    while (!total.expired()) {
+        auto err = getVersion(version, resolve(Deadline::budget()).earlier(total));
         if(err == ESP_OK) {
             if(captureVersion) {
                 *captureVersion = version;
             }
             return ESP_OK;
-        } else if(err != ESP_ERR_TIMEOUT) {
+        } else if(err != ESP_ERR_TIMEOUT && err != ERR_PIXY_LINK_DOWN) {
             return err;
         }
         vTaskDelay(1);
@@ -164,93 +559,224 @@ esp_err_t Pixy2<LinkType>::waitForStartup(VersionResponse *captureVersion, TickT
 }
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::getVersion(VersionResponse& dest) const {
-    const auto verReq = Pixy2::request(PacketType::GET_VERSION);
+esp_err_t Pixy2<LinkType>::getVersion(VersionResponse& dest, const Deadline& dl) const {
+    PacketResponse resp;
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return getVersionLocked(resp, dest, d);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getVersionLocked(PacketResponse& resp, VersionResponse& dest, const Deadline& dl) const {
+    auto err = transactLocked(VERSION_REQUEST, resp, sizeof(VersionResponse), dl);
+    if(err != ESP_OK) {
+        return err;
+    }
 
+    return decode<VersionSchema>(resp, dest);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getResolution(ResolutionResponse& dest, const Deadline& dl) const {
     PacketResponse resp;
-    auto err = transact(verReq, resp);
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return getResolutionLocked(resp, dest, d);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getResolutionLocked(PacketResponse& resp, ResolutionResponse& dest, const Deadline& dl) const {
+    auto err = transactLocked(RESOLUTION_REQUEST, resp, sizeof(ResolutionResponse), dl);
     if(err != ESP_OK) {
         return err;
     }
 
-    if(resp.type() != PacketType::GET_VERSION_RESPONSE) {
-        return ESP_ERR_INVALID_RESPONSE;
+    return decode<ResolutionSchema>(resp, dest);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getFPS(uint32_t& fps, const Deadline& dl) const {
+    PacketResponse resp;
+    auto err = transact(FPS_REQUEST, resp, sizeof(ResultResponse), dl);
+    if(err != ESP_OK) {
+        return err;
     }
 
-    dest = resp.get<VersionResponse>(0);
+    ResultResponse res;
+    err = decode<FpsSchema>(resp, res);
+    if(err != ESP_OK) {
+        return err;
+    } else if(res.result < 0) {
+        return ESP_FAIL;
+    }
+    fps = res.result;
     return ESP_OK;
 }
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::getColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx) const {
-    const auto blocksReq = Pixy2::request(PacketType::GET_BLOCKS, { signaturesMask, maxBlocks });
+esp_err_t Pixy2<LinkType>::getColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx, const Deadline& dl) const {
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        ctx.blocks.reset();
+        return ESP_ERR_TIMEOUT;
+    }
+    return getColorBlocksLocked(signaturesMask, maxBlocks, ctx, d);
+}
 
-    auto& r = ctx.resp;
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getColorBlocksLocked(uint8_t signaturesMask, uint8_t maxBlocks, GetBlocksContext& ctx, const Deadline& dl) const {
+    const auto blocksReq = ColorBlocksSchema::request(signaturesMask, maxBlocks);
 
     ctx.blocks.reset();
 
-    auto err = transact(blocksReq, r);
+    auto err = transactLocked(blocksReq, ctx.resp, std::min(size_t(maxBlocks) * sizeof(ColorBlock), size_t(255)), dl);
+    ctx.timing = timingOf(ctx.resp);
     if(err != ESP_OK) {
         return err;
     }
 
-    if(r.type() == PacketType::ERROR) {
-        return ERR_PIXY_BUSY;
-    } else if(r.type() != PacketType::GET_BLOCKS_RESPONSE) {
-        return ESP_ERR_INVALID_RESPONSE;
-    }
+    return viewColorBlocks(ctx.resp, ctx.blocks);
+}
 
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::submitColorBlocks(uint8_t signaturesMask, uint8_t maxBlocks, const Deadline& dl) const {
+    const auto blocksReq = ColorBlocksSchema::request(signaturesMask, maxBlocks);
+    return submit(blocksReq, std::min(size_t(maxBlocks) * sizeof(ColorBlock), size_t(255)), dl);
+}
 
-    ctx.blocks.reset((ColorBlock*)r.data(), r.dataLen() / sizeof(ColorBlock));
-    return ESP_OK;
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::collectColorBlocks(GetBlocksContext& ctx, const Deadline& dl) const {
+    ctx.blocks.reset();
+
+    auto err = collect(ctx.resp, dl);
+    ctx.timing = timingOf(ctx.resp);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    return viewColorBlocks(ctx.resp, ctx.blocks);
 }
 
 template<typename LinkType>
-esp_err_t Pixy2<LinkType>::getLineFeatures(LineFeaturesContext& ctx, LineFeatures features, bool allFeatures) const {
+esp_err_t Pixy2<LinkType>::getLineFeatures(LineFeaturesContext& ctx, LineFeatures features, bool allFeatures, const Deadline& dl) const {
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        ctx.vectors.reset();
+        ctx.intersections.reset();
+        ctx.barcodes.reset();
+        return ESP_ERR_TIMEOUT;
+    }
+    return getLineFeaturesLocked(ctx, features, allFeatures, d);
+}
 
-    const auto lineReq = Pixy2::request(PacketType::GET_LINE_FEATURES, {
-        uint8_t(allFeatures),
-        uint8_t(features)
-    });
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getLineFeaturesLocked(LineFeaturesContext& ctx, LineFeatures features, bool allFeatures, const Deadline& dl) const {
+    const auto lineReq = LineFeaturesSchema::request(uint8_t(allFeatures), uint8_t(features));
 
     ctx.vectors.reset();
     ctx.intersections.reset();
     ctx.barcodes.reset();
 
     auto& r = ctx.resp;
-    auto err = transact(lineReq, r);
+    // Guess: the main vector, or a few of everything
+    const size_t expected = allFeatures ? 64 : 2 + sizeof(LineVector);
+    auto err = transactLocked(lineReq, r, expected, dl);
+    ctx.timing = timingOf(r);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    return viewLineFeatures(r, ctx.vectors, ctx.intersections, ctx.barcodes);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::setLamp(bool upper, bool lower, const Deadline& dl) const {
+    PacketResponse resp;
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return setLampLocked(resp, upper, lower, d);
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::setLampLocked(PacketResponse& resp, bool upper, bool lower, const Deadline& dl) const {
+    auto err = transactLocked(LampSchema::request(uint8_t(upper), uint8_t(lower)), resp, sizeof(ResultResponse), dl);
     if(err != ESP_OK) {
         return err;
     }
 
-    if(r.type() == PacketType::ERROR) {
-        return ERR_PIXY_BUSY;
-    } else if(r.type() != PacketType::GET_LINE_FEATURES_RESPONSE) {
-        return ESP_ERR_INVALID_RESPONSE;
-    }
-
-    for(size_t off = 0; off < r.dataLen(); ) {
-        const auto ftype = r.get<uint8_t>(off);
-        const auto fsize = r.get<uint8_t>(off+1);
-        
-        const uint8_t *fdata = r.data() + off + 2;
-
-        switch(ftype) {
-        case LineFeatures::VECTORS:
-            ctx.vectors.reset((LineVector*)fdata, fsize / sizeof(LineVector));
-            break;
-        case LineFeatures::INTERSECTIONS:
-            ctx.intersections.reset((LineIntersection*)fdata, fsize / sizeof(LineIntersection));
-            break;
-        case LineFeatures::BARCODES:
-            ctx.barcodes.reset((LineBarCode*)fdata, fsize / sizeof(LineBarCode));
-            break;
+    ResultResponse res;
+    err = decode<LampSchema>(resp, res);
+    if(err == ESP_OK && res.result < 0) {
+        return ESP_FAIL;
+    }
+    return err;
+}
+
+template<typename LinkType>
+esp_err_t Pixy2<LinkType>::getFrame(const FrameQuery& query, FrameContext& ctx, const Deadline& dl) const {
+    for(size_t i = 0; i < FrameQuery::MAX_BLOCK_QUERIES; ++i) {
+        ctx.blocks[i].blocks.reset();
+        ctx.blocksErr[i] = ESP_ERR_INVALID_STATE;
+    }
+    ctx.linesErr = ESP_ERR_INVALID_STATE;
+    ctx.versionErr = ESP_ERR_INVALID_STATE;
+    ctx.resolutionErr = ESP_ERR_INVALID_STATE;
+    ctx.lampErr = ESP_ERR_INVALID_STATE;
+    ctx.timing = FrameTiming();
+
+    esp_err_t first = ESP_OK;
+    auto note = [&](esp_err_t err, const PacketResponse& resp) {
+        if(ctx.timing.requestUs == 0) {
+            ctx.timing = timingOf(resp);
+        }
+        ctx.timing.responseUs = resp.responseUs();
+        if(first == ESP_OK) {
+            first = err;
         }
+        return err;
+    };
 
-        off += fsize + 2;
+    const Deadline d = resolve(dl);
+    LinkLock l(*this, d);
+    if(!l.locked()) {
+        return ESP_ERR_TIMEOUT;
     }
 
-    return ESP_OK;
+    if(query.setLamp) {
+        ctx.lampErr = note(setLampLocked(ctx.scratch, query.upperLamp, query.lowerLamp, d), ctx.scratch);
+    }
+
+    for(size_t i = 0; i < FrameQuery::MAX_BLOCK_QUERIES; ++i) {
+        if(query.signaturesMasks[i] != 0) {
+            auto& blocks = ctx.blocks[i];
+            ctx.blocksErr[i] = note(getColorBlocksLocked(query.signaturesMasks[i], query.maxBlocks, blocks, d), blocks.resp);
+        }
+    }
+
+    if(query.lineFeatures) {
+        ctx.linesErr = note(getLineFeaturesLocked(ctx.lines, query.features, query.allFeatures, d), ctx.lines.resp);
+    }
+
+    if(query.version) {
+        ctx.versionErr = note(getVersionLocked(ctx.scratch, ctx.version, d), ctx.scratch);
+    }
+
+    if(query.resolution) {
+        ctx.resolutionErr = note(getResolutionLocked(ctx.scratch, ctx.resolution, d), ctx.scratch);
+    }
+
+    return first;
 }
 
 };
@@ -22,7 +22,7 @@ public:
 
     const T* operator[]( size_t idx ) const {
         if(idx >= m_size) {
-            ESP_LOGE("PixySpan", "attempted to get idx %d, but only have %d items.", idx, m_size);
+            ESP_LOGE("PixySpan", "attempted to get idx %u, but only have %u items.", unsigned(idx), unsigned(m_size));
             abort();
         }
         return &(m_data[idx]); // zde dodáno &
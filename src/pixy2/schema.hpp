@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string.h>
+#include <type_traits>
+
+#include "packet.hpp"
+#include "pixy_span.hpp"
+
+namespace pixy2 {
+
+// The payload structs are pointed to in place, straight in the received bytes,
+// so they have to be packed and exactly as big as on the wire.
+static_assert(sizeof(ColorBlock) == 14 && alignof(ColorBlock) == 1, "ColorBlock does not match the wire format");
+static_assert(sizeof(ResultResponse) == 4 && alignof(ResultResponse) == 1, "ResultResponse does not match the wire format");
+static_assert(sizeof(ResolutionResponse) == 4 && alignof(ResolutionResponse) == 1, "ResolutionResponse does not match the wire format");
+static_assert(sizeof(VersionResponse) == 16 && alignof(VersionResponse) == 1, "VersionResponse does not match the wire format");
+static_assert(sizeof(LineVector) == 6 && alignof(LineVector) == 1, "LineVector does not match the wire format");
+static_assert(sizeof(LineIntersection) == 28 && alignof(LineIntersection) == 1, "LineIntersection does not match the wire format");
+static_assert(sizeof(LineBarCode) == 4 && alignof(LineBarCode) == 1, "LineBarCode does not match the wire format");
+
+// Compile-time description of one request/response pair: the request type and how many
+// argument bytes it has, the expected response type and what its payload is an array of.
+template<PacketType Request, PacketType Response, typename Element, size_t Args>
+struct PacketSchema {
+    static_assert(alignof(Element) == 1, "payload elements are read in place, they have to be packed");
+    static_assert(std::is_trivially_copyable<Element>::value, "payload elements have to be plain data");
+
+    static constexpr const PacketType REQUEST = Request;
+    static constexpr const PacketType RESPONSE = Response;
+    static constexpr const size_t ARGS = Args;
+    typedef Element ElementType;
+
+    template<typename... T>
+    static constexpr PacketRequest<Args> request(T... args) {
+        return PacketRequest<Args>(Request, args...);
+    }
+};
+
+typedef PacketSchema<GET_VERSION, GET_VERSION_RESPONSE, VersionResponse, 0> VersionSchema;
+// arg: reserved, 0
+typedef PacketSchema<GET_RESOLUTION, GET_RESOLUTION_RESPONSE, ResolutionResponse, 1> ResolutionSchema;
+// result is frames per second
+typedef PacketSchema<GET_FPS, RESULT, ResultResponse, 0> FpsSchema;
+// args: signatures mask, max blocks
+typedef PacketSchema<GET_BLOCKS, GET_BLOCKS_RESPONSE, ColorBlock, 2> ColorBlocksSchema;
+// args: upper lamp (0/1), lower lamp (0/1)
+typedef PacketSchema<SET_LAMP, RESULT, ResultResponse, 2> LampSchema;
+// args: all features (0/1), features mask. Payload is a list of type, length, data entries.
+typedef PacketSchema<GET_LINE_FEATURES, GET_LINE_FEATURES_RESPONSE, uint8_t, 2> LineFeaturesSchema;
+
+// Requests without runtime arguments, built at compile time.
+static constexpr const PacketRequest<0> VERSION_REQUEST = VersionSchema::request();
+static constexpr const PacketRequest<1> RESOLUTION_REQUEST = ResolutionSchema::request(uint8_t(0));
+static constexpr const PacketRequest<0> FPS_REQUEST = FpsSchema::request();
+
+// Checks that r is the response of Schema and points out at its payload.
+// A trailing partial element is not included.
+template<typename Schema>
+esp_err_t decode(const PacketResponse& r, PixySpan<typename Schema::ElementType>& out) {
+    typedef typename Schema::ElementType T;
+    out.reset();
+    if (r.type() == PacketType::ERROR) {
+        return ERR_PIXY_BUSY;
+    } else if (r.type() != Schema::RESPONSE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    out.reset((const T*)r.data(), r.dataLen() / sizeof(T));
+    return ESP_OK;
+}
+
+// Same, for responses which are a single element. It is copied out.
+template<typename Schema>
+esp_err_t decode(const PacketResponse& r, typename Schema::ElementType& out) {
+    if (r.type() == PacketType::ERROR) {
+        return ERR_PIXY_BUSY;
+    } else if (r.type() != Schema::RESPONSE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return r.read(0, out);
+}
+
+// Typed, zero-copy views of complete responses. The spans point into the response.
+
+inline esp_err_t viewColorBlocks(const PacketResponse& r, PixySpan<ColorBlock>& blocks) {
+    return decode<ColorBlocksSchema>(r, blocks);
+}
+
+inline esp_err_t viewLineFeatures(const PacketResponse& r, PixySpan<LineVector>& vectors,
+    PixySpan<LineIntersection>& intersections, PixySpan<LineBarCode>& barcodes) {
+    vectors.reset();
+    intersections.reset();
+    barcodes.reset();
+
+    PixySpan<uint8_t> data;
+    auto err = decode<LineFeaturesSchema>(r, data);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t off = 0; off < data.size();) {
+        if (off + 2 > data.size()) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const auto ftype = data.data()[off];
+        const auto fsize = data.data()[off + 1];
+        const uint8_t *fdata = data.data() + off + 2;
+        if (off + 2 + fsize > data.size()) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        switch (ftype) {
+        case LineFeatures::VECTORS:
+            vectors.reset((const LineVector*)fdata, fsize / sizeof(LineVector));
+            break;
+        case LineFeatures::INTERSECTIONS:
+            intersections.reset((const LineIntersection*)fdata, fsize / sizeof(LineIntersection));
+            break;
+        case LineFeatures::BARCODES:
+            barcodes.reset((const LineBarCode*)fdata, fsize / sizeof(LineBarCode));
+            break;
+        }
+
+        off += fsize + 2;
+    }
+    return ESP_OK;
+}
+
+};
@@ -1,59 +1,119 @@
 #pragma once
 
+#include <algorithm>
 #include <driver/spi_master.h>
+#include <esp_heap_caps.h>
+#include <string.h>
 #include <tuple>
 
+#include "deadline.hpp"
+
 namespace pixy2 {
 
 
 class LinkSpi {
 public:
+    // Size of the DMA buffers in async mode, fits the biggest packet (6 + 255 bytes), rounded up to 4 for DMA.
+    static constexpr const size_t ASYNC_BUFFER_SIZE = 264;
+    static constexpr const size_t ASYNC_REQUEST_SIZE = 32;
+
     // spiDev is now owned by Pixy2 and gets destroyed in destructor
     static LinkSpi existingSpiDevice(spi_device_handle_t spiDev) {
         return LinkSpi(spiDev);
     }
 
-    // host has to be already initialized by spi_bus_initialize
-    static std::tuple<LinkSpi, esp_err_t> addSpiDevice(spi_host_device_t host, int frequency_hz = 6000000) {
-        spi_device_interface_config_t devCfg = { }; // ty prazdne slozene zavorky jsou tady proto, aby se na vychozi hodnotu nastavily automaticky ty promenne, ktere nejsou nastavene na nasledujicich radcich -> bez nich to nejede spravne 
-        devCfg.mode = 3;
-        devCfg.clock_speed_hz = frequency_hz;
-        devCfg.spics_io_num = -1;
-        devCfg.queue_size = 1;
-
+    // host has to be already initialized by spi_bus_initialize.
+    // csPin -1 is the Pixy2's default "Arduino ICSP SPI" interface, the only device on the bus.
+    // To share the bus, set the cameras to "SPI with SS" in PixyMon and give each its own csPin.
+    static std::tuple<LinkSpi, esp_err_t> addSpiDevice(spi_host_device_t host, int frequency_hz = 6000000, int csPin = -1) {
         spi_device_handle_t spiDev;
-        auto err = spi_bus_add_device(host, &devCfg, &spiDev);
+        auto err = addDevice(host, frequency_hz, 1, csPin, &spiDev);
         if(err != ESP_OK) {
             return std::make_tuple(LinkSpi(nullptr), err);
         }
         return std::make_tuple(LinkSpi(spiDev), ESP_OK);
     }
 
+    // Async mode: transfers go through DMA-capable buffers and can be queued with queueTransfer,
+    // so the caller can do something else while the bytes move. Use Pixy2::submit/collect.
+    // host has to be already initialized by spi_bus_initialize with a DMA channel.
+    static std::tuple<LinkSpi, esp_err_t> addSpiDeviceAsync(spi_host_device_t host, int frequency_hz = 6000000, int csPin = -1) {
+        spi_device_handle_t spiDev;
+        auto err = addDevice(host, frequency_hz, 2, csPin, &spiDev);
+        if(err != ESP_OK) {
+            return std::make_tuple(LinkSpi(nullptr), err);
+        }
+
+        // the link frees whatever was allocated
+        LinkSpi link(spiDev);
+        link.m_reqBuf = (uint8_t*)heap_caps_malloc(ASYNC_REQUEST_SIZE, MALLOC_CAP_DMA);
+        link.m_zeroBuf = (uint8_t*)heap_caps_malloc(ASYNC_BUFFER_SIZE, MALLOC_CAP_DMA);
+        link.m_rxBuf = (uint8_t*)heap_caps_malloc(ASYNC_BUFFER_SIZE, MALLOC_CAP_DMA);
+        if(link.m_reqBuf == nullptr || link.m_zeroBuf == nullptr || link.m_rxBuf == nullptr) {
+            return std::make_tuple(std::move(link), ESP_ERR_NO_MEM);
+        }
+        memset(link.m_zeroBuf, 0, ASYNC_BUFFER_SIZE);
+        return std::make_tuple(std::move(link), ESP_OK);
+    }
+
     LinkSpi(LinkSpi&& other) {
         this->m_spiDev = other.m_spiDev;
+        this->m_reqBuf = other.m_reqBuf;
+        this->m_zeroBuf = other.m_zeroBuf;
+        this->m_rxBuf = other.m_rxBuf;
+        this->m_queued = other.m_queued;
         other.m_spiDev = nullptr;
+        other.m_reqBuf = nullptr;
+        other.m_zeroBuf = nullptr;
+        other.m_rxBuf = nullptr;
+        other.m_queued = 0;
     };
 
     ~LinkSpi() {
         if(m_spiDev != nullptr) {
+            waitQueued(portMAX_DELAY);
             spi_bus_remove_device(m_spiDev);
         }
+        heap_caps_free(m_reqBuf);
+        heap_caps_free(m_zeroBuf);
+        heap_caps_free(m_rxBuf);
     }
 
-    esp_err_t receiveData(uint8_t *dest, size_t len) const {
+    bool isAsync() const { return m_rxBuf != nullptr; }
+
+    // An SPI master transfer cannot stall, the deadline is only checked between chunks.
+    esp_err_t receiveData(uint8_t *dest, size_t len, const Deadline& dl = Deadline()) const {
+        if(isAsync()) {
+            // Bigger chunks straight from the DMA buffers, the driver does not have to bounce them.
+            while (len > 0)
+            {
+                if (dl.expired())
+                {
+                    return ESP_ERR_TIMEOUT;
+                }
+                const size_t chunk = std::min(ASYNC_BUFFER_SIZE, len);
+                auto err = transmit(m_zeroBuf, m_rxBuf, chunk);
+                if (err != ESP_OK)
+                {
+                    return err;
+                }
+                memcpy(dest, m_rxBuf, chunk);
+                dest += chunk;
+                len -= chunk;
+            }
+            return ESP_OK;
+        }
+
         uint8_t zerobuf[32] = { };
         while (len > 0)
         {
+            if (dl.expired())
+            {
+                return ESP_ERR_TIMEOUT;
+            }
             const size_t chunk = std::min(sizeof(zerobuf), len);
 
-            spi_transaction_t trans = {};
-            trans.flags = 0;
-            trans.length = chunk * 8;
-            trans.tx_buffer = zerobuf;
-            trans.rx_buffer = dest;
-            
-
-            auto err = spi_device_transmit(m_spiDev, &trans);
+            auto err = transmit(zerobuf, dest, chunk);
             if (err != ESP_OK)
             {
                 return err;
@@ -64,22 +124,118 @@ public:
         return ESP_OK;
     }
 
-    esp_err_t sendData(const uint8_t *data, size_t len) const {
+    esp_err_t sendData(const uint8_t *data, size_t len, const Deadline& dl = Deadline()) const {
+        if(dl.expired()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        return transmit(data, nullptr, len);
+    }
+
+    // After an aborted collectTransfer, waits for the transfers still queued, so the next
+    // synchronous transmit does not pick up their results.
+    esp_err_t recover(const Deadline& dl = Deadline()) const {
+        return waitQueued(dl.ticks(portMAX_DELAY));
+    }
+
+    // Async mode only. Queues sending txLen bytes of data followed by reading rxLen bytes,
+    // returns right away. Exactly one collectTransfer has to follow.
+    esp_err_t queueTransfer(const uint8_t *data, size_t txLen, size_t rxLen) const {
+        if(!isAsync() || m_queued != 0) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if(txLen > ASYNC_REQUEST_SIZE || rxLen > ASYNC_BUFFER_SIZE) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        memcpy(m_reqBuf, data, txLen);
+
+        m_sendTrans = {};
+        m_sendTrans.length = txLen * 8;
+        m_sendTrans.tx_buffer = m_reqBuf;
+
+        m_recvTrans = {};
+        m_recvTrans.length = rxLen * 8;
+        m_recvTrans.tx_buffer = m_zeroBuf;
+        m_recvTrans.rx_buffer = m_rxBuf;
+
+        auto err = spi_device_queue_trans(m_spiDev, &m_sendTrans, 0);
+        if(err != ESP_OK) {
+            return err;
+        }
+        ++m_queued;
+
+        err = spi_device_queue_trans(m_spiDev, &m_recvTrans, 0);
+        if(err != ESP_OK) {
+            waitQueued(portMAX_DELAY);
+            return err;
+        }
+        ++m_queued;
+        return ESP_OK;
+    }
+
+    // Waits for the transfer queued by queueTransfer. On success, rx points to the received bytes,
+    // which stay valid until the next call on this link.
+    esp_err_t collectTransfer(const uint8_t **rx, size_t *rxLen, TickType_t timeout = portMAX_DELAY) const {
+        if(m_queued == 0) {
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        auto err = waitQueued(timeout);
+        if(err != ESP_OK) {
+            return err;
+        }
+
+        *rx = m_rxBuf;
+        *rxLen = m_recvTrans.length / 8;
+        return ESP_OK;
+    }
+
+private:
+    LinkSpi(spi_device_handle_t spiDev) : m_spiDev(spiDev), m_reqBuf(nullptr), m_zeroBuf(nullptr), m_rxBuf(nullptr), m_queued(0) {
+
+    }
+    LinkSpi(const LinkSpi&) = delete;
+
+    static esp_err_t addDevice(spi_host_device_t host, int frequency_hz, int queueSize, int csPin, spi_device_handle_t *spiDev) {
+        spi_device_interface_config_t devCfg = { }; // ty prazdne slozene zavorky jsou tady proto, aby se na vychozi hodnotu nastavily automaticky ty promenne, ktere nejsou nastavene na nasledujicich radcich -> bez nich to nejede spravne
+        devCfg.mode = 3;
+        devCfg.clock_speed_hz = frequency_hz;
+        devCfg.spics_io_num = csPin;
+        devCfg.queue_size = queueSize;
+        return spi_bus_add_device(host, &devCfg, spiDev);
+    }
+
+    esp_err_t transmit(const uint8_t *tx, uint8_t *rx, size_t len) const {
         spi_transaction_t trans = {};
         trans.flags = 0;
         trans.length = len * 8;
-        trans.tx_buffer = data;
-        
+        trans.tx_buffer = tx;
+        trans.rx_buffer = rx;
+
         return spi_device_transmit(m_spiDev, &trans);
     }
 
-private:
-    LinkSpi(spi_device_handle_t spiDev) : m_spiDev(spiDev) {
-
+    esp_err_t waitQueued(TickType_t timeout) const {
+        while(m_queued > 0) {
+            spi_transaction_t *done;
+            auto err = spi_device_get_trans_result(m_spiDev, &done, timeout);
+            if(err != ESP_OK) {
+                return err;
+            }
+            --m_queued;
+        }
+        return ESP_OK;
     }
-    LinkSpi(const LinkSpi&) = delete;
 
     spi_device_handle_t m_spiDev;
+
+    // async mode only
+    uint8_t *m_reqBuf;
+    uint8_t *m_zeroBuf;
+    uint8_t *m_rxBuf;
+    mutable spi_transaction_t m_sendTrans;
+    mutable spi_transaction_t m_recvTrans;
+    mutable uint8_t m_queued;
 };
 
 };
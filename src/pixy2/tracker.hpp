@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "packet.hpp"
+#include "pixy_span.hpp"
+
+namespace pixy2 {
+
+struct TrackerConfig {
+    // alpha-beta filter gains, for position and for velocity
+    float alpha = 0.6f;
+    float beta = 0.2f;
+
+    // A track that was not seen for this long is dropped.
+    int64_t maxCoastUs = 300000;
+
+    // Pixy's block age at which the track is considered fully confirmed.
+    uint8_t confirmedAge = 10;
+};
+
+struct Track {
+    uint16_t signature;
+    // Pixy's tracking index, stays the same while the camera follows the object
+    uint8_t index;
+
+    // filtered position and size, in camera pixels
+    float x, y, w, h;
+    // per second
+    float vx, vy, vw, vh;
+
+    // esp_timer_get_time() of the frame that last saw it
+    int64_t updatedUs;
+    uint8_t age;
+    uint16_t misses;
+};
+
+// Track state projected to some point in time.
+struct PredictedBlock {
+    uint16_t signature;
+    uint8_t index;
+    float x, y, w, h;
+    // 0 to 1, falls off with age and time since the track was last seen
+    float confidence;
+};
+
+// Keeps persistent tracks of ColorBlocks, using the index Pixy assigns to each tracked object,
+// and filters them with a constant-velocity alpha-beta filter, so the control loop can ask
+// for positions between camera frames. Fixed capacity, no allocations.
+template<size_t MaxTracks = 16>
+class BlockTracker {
+public:
+    BlockTracker(const TrackerConfig& cfg = TrackerConfig()) : m_cfg(cfg), m_count(0) {}
+
+    // Feed one camera frame. timestampUs should be when it was captured (or at least received).
+    void update(const ColorBlock *blocks, size_t count, int64_t timestampUs) {
+        for (size_t i = 0; i < m_count; ++i) {
+            m_seen[i] = false;
+        }
+
+        for (size_t b = 0; b < count; ++b) {
+            const ColorBlock& block = blocks[b];
+            Track *t = findMutable(block.index, block.signature);
+            if (t == nullptr) {
+                add(block, timestampUs);
+            } else {
+                correct(*t, block, timestampUs);
+                m_seen[t - m_tracks] = true;
+            }
+        }
+
+        // drop the ones which are gone for too long, keep the rest coasting
+        for (size_t i = 0; i < m_count;) {
+            Track& t = m_tracks[i];
+            if (!m_seen[i]) {
+                ++t.misses;
+                if (timestampUs - t.updatedUs > m_cfg.maxCoastUs) {
+                    remove(i);
+                    continue;
+                }
+            }
+            ++i;
+        }
+    }
+
+    void update(const PixySpan<ColorBlock>& blocks, int64_t timestampUs) {
+        update(blocks.data(), blocks.size(), timestampUs);
+    }
+
+    void clear() { m_count = 0; }
+
+    size_t size() const { return m_count; }
+    const Track *begin() const { return m_tracks; }
+    const Track *end() const { return m_tracks + m_count; }
+
+    const Track *find(uint8_t index, uint16_t signature) const {
+        for (size_t i = 0; i < m_count; ++i) {
+            if (m_tracks[i].index == index && m_tracks[i].signature == signature) {
+                return &m_tracks[i];
+            }
+        }
+        return nullptr;
+    }
+
+    PredictedBlock predict(const Track& t, int64_t atUs) const {
+        const float dt = (atUs - t.updatedUs) * 1e-6f;
+
+        PredictedBlock p;
+        p.signature = t.signature;
+        p.index = t.index;
+        p.x = t.x + t.vx * dt;
+        p.y = t.y + t.vy * dt;
+        p.w = std::max(0.f, t.w + t.vw * dt);
+        p.h = std::max(0.f, t.h + t.vh * dt);
+        p.confidence = confidence(t, atUs);
+        return p;
+    }
+
+    // The most confident track of the signature, projected to atUs. Returns false if there is none.
+    bool best(uint16_t signature, int64_t atUs, PredictedBlock& out) const {
+        bool found = false;
+        for (size_t i = 0; i < m_count; ++i) {
+            if (m_tracks[i].signature != signature) {
+                continue;
+            }
+            const auto p = predict(m_tracks[i], atUs);
+            if (!found || p.confidence > out.confidence) {
+                out = p;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    float confidence(const Track& t, int64_t atUs) const {
+        const float confirmed = std::min(1.f, float(t.age) / m_cfg.confirmedAge);
+        const float staleness = float(atUs - t.updatedUs) / m_cfg.maxCoastUs;
+        return confirmed * std::max(0.f, std::min(1.f, 1.f - staleness));
+    }
+
+private:
+    Track *findMutable(uint8_t index, uint16_t signature) {
+        return const_cast<Track*>(find(index, signature));
+    }
+
+    void add(const ColorBlock& block, int64_t timestampUs) {
+        if (m_count == MaxTracks) {
+            // replace the stalest one
+            size_t oldest = 0;
+            for (size_t i = 1; i < m_count; ++i) {
+                if (m_tracks[i].updatedUs < m_tracks[oldest].updatedUs) {
+                    oldest = i;
+                }
+            }
+            remove(oldest);
+        }
+
+        Track& t = m_tracks[m_count];
+        t.signature = block.signature;
+        t.index = block.index;
+        t.x = block.x;
+        t.y = block.y;
+        t.w = block.w;
+        t.h = block.h;
+        t.vx = t.vy = t.vw = t.vh = 0;
+        t.updatedUs = timestampUs;
+        t.age = block.age;
+        t.misses = 0;
+        m_seen[m_count] = true;
+        ++m_count;
+    }
+
+    void correct(Track& t, const ColorBlock& block, int64_t timestampUs) {
+        t.age = block.age;
+        t.misses = 0;
+
+        const float dt = (timestampUs - t.updatedUs) * 1e-6f;
+        if (dt <= 0) {
+            // same frame again
+            return;
+        }
+
+        filter(t.x, t.vx, block.x, dt);
+        filter(t.y, t.vy, block.y, dt);
+        filter(t.w, t.vw, block.w, dt);
+        filter(t.h, t.vh, block.h, dt);
+        t.updatedUs = timestampUs;
+    }
+
+    void filter(float& pos, float& vel, float measured, float dt) const {
+        const float predicted = pos + vel * dt;
+        const float residual = measured - predicted;
+        pos = predicted + m_cfg.alpha * residual;
+        vel += m_cfg.beta * residual / dt;
+    }
+
+    void remove(size_t idx) {
+        --m_count;
+        m_tracks[idx] = m_tracks[m_count];
+        m_seen[idx] = m_seen[m_count];
+    }
+
+    TrackerConfig m_cfg;
+    Track m_tracks[MaxTracks];
+    bool m_seen[MaxTracks];
+    size_t m_count;
+};
+
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace pixy2 {
+
+// Wait-free single producer, single consumer triple buffer. The writer fills back() and publishes it,
+// the reader picks up the newest published value with update() and reads it through front().
+// Neither side ever blocks, values the reader did not pick up in time are overwritten.
+template<typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : m_middle(1), m_back(0), m_front(2) {}
+
+    // writer side
+    T& back() { return m_buffers[m_back]; }
+
+    void publish() {
+        m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // reader side, returns true if front() changed
+    bool update() {
+        if((m_middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T& front() const { return m_buffers[m_front]; }
+
+private:
+    TripleBuffer(const TripleBuffer&) = delete;
+
+    static constexpr const uint8_t INDEX_MASK = 0x03;
+    static constexpr const uint8_t FRESH = 0x04;
+
+    T m_buffers[3];
+    std::atomic<uint8_t> m_middle;
+    uint8_t m_back;
+    uint8_t m_front;
+};
+
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <type_traits>
+
+// Single writer, any number of readers, nobody ever blocks. The writer bumps the sequence
+// to odd, writes, bumps it back to even. Readers copy and retry if the sequence moved.
+// Meant for small plain structs written much more often than a reader could starve.
+template<typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "the value is copied while it may be changing");
+public:
+    SeqLock() : m_seq(0), m_value() {}
+
+    // Only ever from one task.
+    void write(const T& value) {
+        const uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_value = value;
+        std::atomic_thread_fence(std::memory_order_release);
+        m_seq.store(seq + 2, std::memory_order_relaxed);
+    }
+
+    T read() const {
+        T result;
+        uint32_t before, after;
+        do {
+            before = m_seq.load(std::memory_order_acquire);
+            result = m_value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_seq.load(std::memory_order_relaxed);
+        } while((before & 1) || before != after);
+        return result;
+    }
+
+    // changes with every write
+    uint32_t sequence() const { return m_seq.load(std::memory_order_acquire) >> 1; }
+
+private:
+    std::atomic<uint32_t> m_seq;
+    T m_value;
+};
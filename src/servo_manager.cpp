@@ -0,0 +1,79 @@
+#include <esp_timer.h>
+
+#include "servo_manager.hpp"
+#include "trace.hpp"
+
+namespace control {
+
+ServoManager::ServoManager(const ServoBusOps& ops, uint8_t count)
+    : m_ops(ops), m_count(count < MAX_SERVOS ? count : MAX_SERVOS), m_staged(), m_nextPoll(0) {
+    for(size_t i = 0; i < MAX_SERVOS; ++i) {
+        m_sent[i] = 0;
+        m_positions[i].write(ServoPosition { 0, 0, ESP_ERR_INVALID_STATE });
+    }
+    m_targets.write(m_staged);
+}
+
+esp_err_t ServoManager::start(const LoopConfig& loop) {
+    if(m_ops.write == nullptr || m_ops.read == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return std::get<1>(Runtime::get().add(loop, [this]() { update(); }));
+}
+
+esp_err_t ServoManager::set(const ServoTarget *targets, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        if(targets[i].id >= m_count) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+        const auto& t = targets[i];
+        m_staged.deg[t.id] = t.deg;
+        ++m_staged.generation[t.id];
+        TRACE(SERVO_SET, uint32_t(t.id) << 16 | uint16_t(int16_t(t.deg)));
+    }
+    m_targets.write(m_staged);
+    return ESP_OK;
+}
+
+ServoPosition ServoManager::position(uint8_t id) const {
+    if(id >= m_count) {
+        return ServoPosition { 0, 0, ESP_ERR_INVALID_ARG };
+    }
+    return m_positions[id].read();
+}
+
+void ServoManager::update() {
+    const Targets targets = m_targets.read();
+
+    bool wrote = false;
+    for(uint8_t id = 0; id < m_count; ++id) {
+        if(targets.generation[id] != m_sent[id]) {
+            m_ops.write(id, targets.deg[id], m_ops.ctx);
+            m_sent[id] = targets.generation[id];
+            wrote = true;
+        }
+    }
+    if(wrote && m_ops.commit != nullptr) {
+        m_ops.commit(m_ops.ctx);
+    }
+
+    if(m_count == 0) {
+        return;
+    }
+    const uint8_t id = m_nextPoll;
+    m_nextPoll = (m_nextPoll + 1) % m_count;
+
+    ServoPosition p;
+    p.err = m_ops.read(id, p.deg, m_ops.ctx);
+    p.timestampUs = esp_timer_get_time();
+    if(p.err != ESP_OK) {
+        // keep the last good angle
+        p.deg = m_positions[id].read().deg;
+    }
+    m_positions[id].write(p);
+}
+
+};
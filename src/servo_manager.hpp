@@ -0,0 +1,89 @@
+#pragma once
+
+// Owns the smart servo bus: all writes and position reads go through one control::Runtime loop.
+// Targets set together go out together in the same pass, positions are polled round-robin
+// into a cache, so reading them costs nothing and never touches the bus.
+
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "seqlock.hpp"
+
+namespace control {
+
+// What the manager needs from the bus, called only from its loop.
+struct ServoBusOps {
+    // Move servo id to deg. If the bus can hold a move until commit (e.g. LX-16A's
+    // MOVE_TIME_WAIT_WRITE), it should, otherwise move right away.
+    esp_err_t (*write)(uint8_t id, float deg, void *ctx) = nullptr;
+    // Start all held moves at once (e.g. a broadcast MOVE_START), nullptr if not supported.
+    void (*commit)(void *ctx) = nullptr;
+    // Read the position, this is the slow part, a whole bus round trip.
+    esp_err_t (*read)(uint8_t id, float& deg, void *ctx) = nullptr;
+    void *ctx = nullptr;
+};
+
+struct ServoTarget {
+    uint8_t id;
+    float deg;
+};
+
+struct ServoPosition {
+    float deg;
+    // esp_timer_get_time() of the read, 0 if it was not read yet
+    int64_t timestampUs;
+    esp_err_t err;
+};
+
+class ServoManager {
+public:
+    static constexpr const size_t MAX_SERVOS = 8;
+
+    // Servos are 0 .. count-1, as set up by initSmartServoBus.
+    ServoManager(const ServoBusOps& ops, uint8_t count);
+
+    // Registers update() with the control::Runtime.
+    esp_err_t start(const LoopConfig& loop);
+
+    // One pass: send the changed targets, then read one position. Only ever from one task.
+    void update();
+
+    // All targets of one call are sent in the same pass. From one task at a time, does not block.
+    esp_err_t set(const ServoTarget *targets, size_t count);
+    esp_err_t set(uint8_t id, float deg) {
+        const ServoTarget t = { id, deg };
+        return set(&t, 1);
+    }
+    template<size_t N>
+    esp_err_t set(const ServoTarget (&targets)[N]) { return set(targets, N); }
+
+    // Last polled position, never blocks. Every servo is read once per count() passes.
+    ServoPosition position(uint8_t id) const;
+
+    uint8_t count() const { return m_count; }
+
+private:
+    ServoManager(const ServoManager&) = delete;
+
+    struct Targets {
+        float deg[MAX_SERVOS];
+        // bumped with every set of the servo
+        uint32_t generation[MAX_SERVOS];
+    };
+
+    ServoBusOps m_ops;
+    uint8_t m_count;
+
+    SeqLock<Targets> m_targets;
+    SeqLock<ServoPosition> m_positions[MAX_SERVOS];
+
+    // only touched by set()
+    Targets m_staged;
+
+    // only touched by update()
+    uint32_t m_sent[MAX_SERVOS];
+    uint8_t m_nextPoll;
+};
+
+};
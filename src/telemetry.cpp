@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "telemetry.hpp"
+
+namespace telemetry {
+
+static const char *TAG = "telemetry";
+
+static_assert(sizeof(DatagramHeader) == 8, "DatagramHeader is sent raw, keep it packed");
+static_assert(sizeof(RecordHeader) == 6, "RecordHeader is sent raw, keep it packed");
+static_assert(sizeof(OdometryRecord) == 24, "OdometryRecord is sent raw, keep it packed");
+static_assert(sizeof(pixy2::ColorBlock) == 14, "ColorBlock is sent raw, keep it packed");
+static_assert(sizeof(trace::Record) == 12, "trace::Record is sent raw, keep it packed");
+
+// the fields updated in place, in the raw buffers
+static constexpr const size_t RECORDS_AT = offsetof(DatagramHeader, records);
+static constexpr const size_t TYPE_AT = offsetof(RecordHeader, type);
+static constexpr const size_t LENGTH_AT = offsetof(RecordHeader, length);
+
+Channel::Channel(const ChannelConfig& cfg) : m_cfg(cfg), m_filling(nullptr), m_seq(0), m_sent(0), m_dropped(0) {
+    m_cfg.maxDatagram = std::max(uint16_t(sizeof(DatagramHeader) + sizeof(RecordHeader) + MAX_PAYLOAD),
+        std::min(m_cfg.maxDatagram, uint16_t(MAX_DATAGRAM)));
+    for(auto& buf : m_buffers) {
+        buf.len = 0;
+        buf.lastRecord = 0;
+        buf.state = FREE;
+    }
+}
+
+esp_err_t Channel::start(const control::LoopConfig& loop) {
+    if(m_cfg.send == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return std::get<1>(control::Runtime::get().add(loop, [this]() { flush(); }));
+}
+
+void Channel::finishLocked(Buffer& buf) {
+    auto *header = (DatagramHeader*)buf.data;
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->seq = m_seq++;
+    buf.state = READY;
+    if(m_filling == &buf) {
+        m_filling = nullptr;
+    }
+}
+
+uint8_t *Channel::beginRecordLocked(RecordType type, size_t len) {
+    const size_t size = sizeof(RecordHeader) + len;
+    if(m_filling != nullptr && (m_filling->len + size > m_cfg.maxDatagram || m_filling->data[RECORDS_AT] == 255)) {
+        finishLocked(*m_filling);
+    }
+
+    if(m_filling == nullptr) {
+        for(auto& buf : m_buffers) {
+            if(buf.state == FREE) {
+                m_filling = &buf;
+                break;
+            }
+        }
+        if(m_filling == nullptr) {
+            return nullptr;
+        }
+        m_filling->state = FILLING;
+        m_filling->len = sizeof(DatagramHeader);
+        m_filling->data[RECORDS_AT] = 0;
+    }
+
+    auto& buf = *m_filling;
+    RecordHeader header;
+    header.type = type;
+    header.length = len;
+    header.timeUs = esp_timer_get_time();
+    memcpy(buf.data + buf.len, &header, sizeof(header));
+
+    buf.lastRecord = buf.len;
+    buf.len += size;
+    ++buf.data[RECORDS_AT];
+    return buf.data + buf.lastRecord + sizeof(RecordHeader);
+}
+
+esp_err_t Channel::push(RecordType type, const void *payload, size_t len) {
+    if(len > MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    uint8_t *dest = beginRecordLocked(type, len);
+    if(dest == nullptr) {
+        ++m_dropped;
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(dest, payload, len);
+    return ESP_OK;
+}
+
+esp_err_t Channel::append(RecordType type, const void *item, size_t len) {
+    if(len > MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    if(m_filling != nullptr && m_filling->lastRecord != 0) {
+        auto& buf = *m_filling;
+        uint8_t *last = buf.data + buf.lastRecord;
+        if(last[TYPE_AT] == type && last[LENGTH_AT] + len <= MAX_PAYLOAD && buf.len + len <= m_cfg.maxDatagram) {
+            memcpy(buf.data + buf.len, item, len);
+            buf.len += len;
+            last[LENGTH_AT] += len;
+            return ESP_OK;
+        }
+    }
+
+    uint8_t *dest = beginRecordLocked(type, len);
+    if(dest == nullptr) {
+        ++m_dropped;
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(dest, item, len);
+    return ESP_OK;
+}
+
+esp_err_t Channel::pushOdometry(const control::OdometrySnapshot& s) {
+    OdometryRecord r;
+    r.xUm = s.xUm;
+    r.yUm = s.yUm;
+    r.heading = s.heading;
+    r.leftUmPerS = s.leftUmPerS;
+    r.rightUmPerS = s.rightUmPerS;
+    r.yawMradPerS = s.yawMradPerS;
+    return push(ODOMETRY, &r, sizeof(r));
+}
+
+esp_err_t Channel::pushBlocks(uint32_t frameSeq, const pixy2::ColorBlock *blocks, size_t count) {
+    count = std::min(count, MAX_RECORD_BLOCKS);
+    const size_t len = sizeof(BlocksRecord) + count * sizeof(pixy2::ColorBlock);
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    uint8_t *dest = beginRecordLocked(BLOCKS, len);
+    if(dest == nullptr) {
+        ++m_dropped;
+        return ESP_ERR_NO_MEM;
+    }
+    const BlocksRecord r = { frameSeq };
+    memcpy(dest, &r, sizeof(r));
+    memcpy(dest + sizeof(r), blocks, count * sizeof(pixy2::ColorBlock));
+    return ESP_OK;
+}
+
+void Channel::traceWriter(const void *data, size_t len, void *ctx) {
+    ((Channel*)ctx)->append(TRACE, data, len);
+}
+
+void Channel::flush() {
+    Buffer *ready[BUFFERS];
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        if(m_filling != nullptr && m_filling->data[RECORDS_AT] != 0) {
+            finishLocked(*m_filling);
+        }
+        for(auto& buf : m_buffers) {
+            if(buf.state == READY) {
+                buf.state = SENDING;
+                ready[count++] = &buf;
+            }
+        }
+    }
+
+    // in the order they were finished
+    std::sort(ready, ready + count, [](const Buffer *a, const Buffer *b) {
+        return int32_t(((const DatagramHeader*)a->data)->seq - ((const DatagramHeader*)b->data)->seq) < 0;
+    });
+    for(size_t i = 0; i < count; ++i) {
+        m_cfg.send(ready[i]->data, ready[i]->len, m_cfg.sendCtx);
+    }
+    m_sent += count;
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    for(size_t i = 0; i < count; ++i) {
+        ready[i]->state = FREE;
+    }
+}
+
+UdpLink::UdpLink() : m_socket(-1), m_subscribed(false) {
+    memset(&m_peer, 0, sizeof(m_peer));
+}
+
+UdpLink::~UdpLink() {
+    if(m_socket >= 0) {
+        close(m_socket);
+    }
+}
+
+esp_err_t UdpLink::open(uint16_t port) {
+    if(m_socket >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(m_socket < 0) {
+        ESP_LOGE(TAG, "failed to create the socket: %d", errno);
+        return ESP_FAIL;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(m_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "failed to bind to port %d: %d", port, errno);
+        close(m_socket);
+        m_socket = -1;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void UdpLink::pollSubscribers() {
+    uint8_t buf[16];
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    while(recvfrom(m_socket, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromLen) >= 0) {
+        if(!m_subscribed || from.sin_addr.s_addr != m_peer.sin_addr.s_addr || from.sin_port != m_peer.sin_port) {
+            ESP_LOGI(TAG, "streaming to %s:%d", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+        }
+        m_peer = from;
+        m_subscribed = true;
+        fromLen = sizeof(from);
+    }
+}
+
+void UdpLink::send(const uint8_t *data, size_t len, void *ctx) {
+    auto *self = (UdpLink*)ctx;
+    if(self->m_socket < 0) {
+        return;
+    }
+
+    self->pollSubscribers();
+    if(self->m_subscribed) {
+        sendto(self->m_socket, data, len, MSG_DONTWAIT, (struct sockaddr*)&self->m_peer, sizeof(self->m_peer));
+    }
+}
+
+};
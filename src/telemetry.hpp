@@ -0,0 +1,165 @@
+#pragma once
+
+// Compact binary telemetry for the high-rate streams (odometry, Pixy2 blocks, trace events),
+// next to RBControl's JSON channel. Samples are packed as records into datagrams of up to
+// maxDatagram bytes, each datagram numbered so the receiver sees what got lost.
+// Decoded on the PC by pc_controller/telemetry.py, keep the two in sync.
+//
+// Wire format, little endian, packed:
+//   datagram: DatagramHeader, then `records` records
+//   record:   RecordHeader, then `length` bytes of payload
+
+#include <atomic>
+#include <esp_err.h>
+#include <lwip/sockets.h>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "odometry.hpp"
+#include "pixy2/packet.hpp"
+#include "trace.hpp"
+
+namespace telemetry {
+
+static constexpr const uint16_t MAGIC = 0x4D54; // "TM"
+static constexpr const uint8_t VERSION = 1;
+
+// The robot listens here, the PC sends any datagram to subscribe and repeats it to stay subscribed.
+static constexpr const uint16_t UDP_PORT = 42425;
+
+enum RecordType : uint8_t {
+    ODOMETRY = 1, // OdometryRecord
+    BLOCKS = 2, // BlocksRecord, then pixy2::ColorBlock[]
+    TRACE = 3, // trace::Record[]
+
+    USER = 128, // free for ad-hoc streams
+};
+
+struct DatagramHeader {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t records;
+    uint32_t seq;
+} __attribute__((packed));
+
+struct RecordHeader {
+    uint8_t type;
+    uint8_t length;
+    // low 32 bits of esp_timer_get_time() when the record was started
+    uint32_t timeUs;
+} __attribute__((packed));
+
+struct OdometryRecord {
+    int32_t xUm;
+    int32_t yUm;
+    uint32_t heading; // Angle32
+    int32_t leftUmPerS;
+    int32_t rightUmPerS;
+    int32_t yawMradPerS;
+} __attribute__((packed));
+
+struct BlocksRecord {
+    uint32_t frameSeq;
+} __attribute__((packed));
+
+static constexpr const size_t MAX_PAYLOAD = 255;
+static constexpr const size_t MAX_RECORD_BLOCKS = (MAX_PAYLOAD - sizeof(BlocksRecord)) / sizeof(pixy2::ColorBlock);
+
+// Sends one finished datagram, e.g. UdpLink::send.
+typedef void (*DatagramSender)(const uint8_t *data, size_t len, void *ctx);
+
+struct ChannelConfig {
+    DatagramSender send = nullptr;
+    void *sendCtx = nullptr;
+
+    // keep it under the MTU, the datagrams must not get fragmented
+    uint16_t maxDatagram = 1400;
+};
+
+// Producers append records from any task, which only copies them into a buffer. The datagrams
+// go out from flush(), usually the Channel's own control::Runtime loop, so nothing else ever
+// waits for the network. If the network falls behind, new records are dropped and counted.
+class Channel {
+public:
+    static constexpr const size_t MAX_DATAGRAM = 1472;
+    static constexpr const size_t BUFFERS = 4;
+
+    Channel(const ChannelConfig& cfg);
+
+    // Registers flush() with the control::Runtime, its period is the batching interval.
+    esp_err_t start(const control::LoopConfig& loop);
+
+    // Sends everything buffered so far. Only ever from one task.
+    void flush();
+
+    // ESP_ERR_INVALID_SIZE if the payload is over MAX_PAYLOAD, ESP_ERR_NO_MEM if it was dropped.
+    esp_err_t push(RecordType type, const void *payload, size_t len);
+
+    // Like push, but extends the previous record if it has the same type and there is room,
+    // for streams of small fixed-size items (trace events).
+    esp_err_t append(RecordType type, const void *item, size_t len);
+
+    esp_err_t pushOdometry(const control::OdometrySnapshot& s);
+    esp_err_t pushBlocks(uint32_t frameSeq, const pixy2::ColorBlock *blocks, size_t count);
+
+    // A trace::Writer for trace::dumpEvents, appends the events as TRACE records.
+    static void traceWriter(const void *data, size_t len, void *ctx);
+
+    uint32_t sent() const { return m_sent; }
+    uint32_t dropped() const { return m_dropped; }
+
+private:
+    Channel(const Channel&) = delete;
+
+    enum State : uint8_t { FREE, FILLING, READY, SENDING };
+
+    struct Buffer {
+        uint8_t data[MAX_DATAGRAM];
+        uint16_t len;
+        // where the last record starts, for append()
+        uint16_t lastRecord;
+        State state;
+    };
+
+    // With m_mutex held. Starts a record and returns where its payload goes,
+    // nullptr if there is no room anywhere.
+    uint8_t *beginRecordLocked(RecordType type, size_t len);
+    void finishLocked(Buffer& buf);
+
+    ChannelConfig m_cfg;
+
+    std::mutex m_mutex;
+    Buffer m_buffers[BUFFERS];
+    Buffer *m_filling;
+    uint32_t m_seq;
+
+    std::atomic<uint32_t> m_sent;
+    std::atomic<uint32_t> m_dropped;
+};
+
+// The UDP side: listens on UDP_PORT and streams the datagrams to whoever sent the last
+// datagram there (the pc_controller proxy), nothing is sent until someone subscribes.
+class UdpLink {
+public:
+    UdpLink();
+    ~UdpLink();
+
+    esp_err_t open(uint16_t port = UDP_PORT);
+
+    // A DatagramSender, ctx is the UdpLink.
+    static void send(const uint8_t *data, size_t len, void *ctx);
+
+private:
+    UdpLink(const UdpLink&) = delete;
+
+    // Picks up subscriptions, never blocks.
+    void pollSubscribers();
+
+    int m_socket;
+    bool m_subscribed;
+    struct sockaddr_in m_peer;
+};
+
+};
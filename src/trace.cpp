@@ -0,0 +1,120 @@
+#ifdef ROBOT_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <esp_clk.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <xtensa/hal.h>
+
+#include "trace.hpp"
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 512
+#endif
+
+namespace trace {
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE has to be a power of two");
+static_assert(sizeof(Record) == 12, "Record is written raw, keep it packed");
+
+static constexpr const size_t BUCKETS = 32;
+
+// One per core, so the cores never fight over a cache line. Tasks on the same core
+// can still preempt each other, hence the atomic slot reservation.
+struct Ring {
+    Record records[TRACE_RING_SIZE];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> histograms[HIST_COUNT][BUCKETS];
+};
+
+static Ring s_rings[portNUM_PROCESSORS];
+
+uint32_t now() {
+    return xthal_get_ccount();
+}
+
+void record(Event event, uint32_t arg) {
+    const uint32_t cycles = xthal_get_ccount();
+    const uint8_t core = xPortGetCoreID();
+    auto& ring = s_rings[core];
+
+    const uint32_t slot = ring.head.fetch_add(1, std::memory_order_relaxed);
+    auto& r = ring.records[slot & (TRACE_RING_SIZE - 1)];
+    r.cycles = cycles;
+    r.arg = arg;
+    r.event = event;
+    r.core = core;
+    r.seq = slot;
+}
+
+void latency(Histogram hist, uint32_t startCycles) {
+    const uint32_t cycles = xthal_get_ccount() - startCycles;
+    const size_t bucket = cycles == 0 ? 0 : 32 - __builtin_clz(cycles);
+    s_rings[xPortGetCoreID()].histograms[hist][std::min(bucket, BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void dumpEvents(Writer writer, void *ctx) {
+    for (auto& ring : s_rings) {
+        const uint32_t head = ring.head.load(std::memory_order_relaxed);
+        const uint32_t count = std::min(head, uint32_t(TRACE_RING_SIZE));
+        for (uint32_t i = head - count; i != head; ++i) {
+            const Record r = ring.records[i & (TRACE_RING_SIZE - 1)];
+            writer(&r, sizeof(r), ctx);
+        }
+    }
+}
+
+void dumpHistograms(Writer writer, void *ctx) {
+    static const char *names[HIST_COUNT] = { "pixy_transact", "loop" };
+    const uint32_t cyclesPerUs = esp_clk_cpu_freq() / 1000000;
+
+    char line[96];
+    for (size_t h = 0; h < HIST_COUNT; ++h) {
+        uint32_t total = 0;
+        for (auto& ring : s_rings) {
+            for (auto& b : ring.histograms[h]) {
+                total += b.load(std::memory_order_relaxed);
+            }
+        }
+        if (total == 0) {
+            continue;
+        }
+
+        int len = snprintf(line, sizeof(line), "%s: %u samples\n", names[h], total);
+        writer(line, len, ctx);
+
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            uint32_t count = 0;
+            for (auto& ring : s_rings) {
+                count += ring.histograms[h][b].load(std::memory_order_relaxed);
+            }
+            if (count == 0) {
+                continue;
+            }
+            // bucket b holds durations in [2^(b-1), 2^b) cycles
+            const uint32_t upToUs = (uint64_t(1) << b) / cyclesPerUs;
+            len = snprintf(line, sizeof(line), "  < %8u us: %u\n", upToUs, count);
+            writer(line, len, ctx);
+        }
+    }
+}
+
+void resetHistograms() {
+    for (auto& ring : s_rings) {
+        for (auto& hist : ring.histograms) {
+            for (auto& b : hist) {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void serialWriter(const void *data, size_t len, void *ctx) {
+    fwrite(data, 1, len, stdout);
+}
+
+};
+
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+// Low-overhead tracing: fixed-size binary events in a per-core ring buffer and log2 latency
+// histograms, formatted only when dumped. Compiled in only with -DROBOT_TRACE,
+// otherwise all the TRACE_* macros are empty.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace trace {
+
+enum Event : uint8_t {
+    PIXY_TRANSACT_BEGIN = 1, // arg: request type
+    PIXY_TRANSACT_END, // arg: esp_err_t
+    PIXY_SYNC_SKIPPED, // arg: bytes skipped before the sync word
+    PIXY_CSUM_FAIL, // arg: calculated << 16 | expected
+    MOTOR_POWER, // arg: left << 16 | right, in percent
+    SERVO_SET, // arg: id << 16 | angle in degrees
+    LOOP_ITERATION, // arg: iteration
+    LOOP_OVERRUN, // arg: control loop index << 16 | periods missed
+    VELOCITY_SET, // arg: left << 16 | right, in mm/s
+
+    USER = 128, // free for ad-hoc events
+};
+
+enum Histogram : uint8_t {
+    HIST_PIXY_TRANSACT,
+    HIST_LOOP,
+
+    HIST_COUNT,
+};
+
+// 12 bytes, written as-is by dumpEvents
+struct Record {
+    uint32_t cycles;
+    uint32_t arg;
+    uint8_t event;
+    uint8_t core;
+    uint16_t seq;
+};
+
+// Receives the dump output, e.g. to write it to serial or send it over UDP.
+typedef void (*Writer)(const void *data, size_t len, void *ctx);
+
+#ifdef ROBOT_TRACE
+
+uint32_t now();
+void record(Event event, uint32_t arg = 0);
+void latency(Histogram hist, uint32_t startCycles);
+
+// Raw Records, oldest first, per core.
+void dumpEvents(Writer writer, void *ctx);
+// Text table with the bucket counts of every non-empty histogram, in microseconds.
+void dumpHistograms(Writer writer, void *ctx);
+void resetHistograms();
+
+// Writer for stdout (the serial console).
+void serialWriter(const void *data, size_t len, void *ctx);
+
+class Scope {
+public:
+    Scope(Histogram hist, Event begin, Event end, uint32_t arg) : m_start(now()), m_hist(hist), m_end(end) {
+        record(begin, arg);
+    }
+    ~Scope() {
+        record(m_end, m_result);
+        latency(m_hist, m_start);
+    }
+
+    void result(uint32_t r) { m_result = r; }
+
+private:
+    uint32_t m_start;
+    uint32_t m_result = 0;
+    Histogram m_hist;
+    Event m_end;
+};
+
+#define TRACE(event, arg) ::trace::record(::trace::event, (arg))
+#define TRACE_SCOPE(name, hist, begin, end, arg) ::trace::Scope name(::trace::hist, ::trace::begin, ::trace::end, (arg))
+#define TRACE_SCOPE_RESULT(name, r) name.result(r)
+
+#else
+
+#define TRACE(event, arg) do { } while(0)
+#define TRACE_SCOPE(name, hist, begin, end, arg) do { } while(0)
+#define TRACE_SCOPE_RESULT(name, r) do { } while(0)
+
+#endif
+
+};
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <esp_timer.h>
+#include <math.h>
+
+#include "trace.hpp"
+#include "velocity_controller.hpp"
+
+namespace control {
+
+VelocityController::VelocityController(const VelocityControllerConfig& cfg, const Odometry& odometry)
+    : m_cfg(cfg), m_odometry(odometry), m_lastUs(0), m_active(false) {
+    m_setpoint.write(Setpoint { 0, 0 });
+    m_status.write(VelocityStatus());
+}
+
+esp_err_t VelocityController::start(const LoopConfig& loop) {
+    if(m_cfg.write == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return std::get<1>(Runtime::get().add(loop, [this]() { update(); }));
+}
+
+void VelocityController::setVelocity(float leftMmPerS, float rightMmPerS) {
+    m_setpoint.write(Setpoint { leftMmPerS, rightMmPerS });
+    TRACE(VELOCITY_SET, uint32_t(int16_t(leftMmPerS)) << 16 | uint16_t(int16_t(rightMmPerS)));
+}
+
+float VelocityController::Wheel::step(const WheelGains& gains, float setpoint, float measured, float dt, const VelocityControllerConfig& cfg) {
+    // ramp the target, harder when it gets closer to zero
+    const bool braking = fabsf(setpoint) < fabsf(target) || setpoint * target < 0;
+    const float maxStep = (braking ? cfg.maxDecel : cfg.maxAccel) * dt;
+    target += std::max(-maxStep, std::min(maxStep, setpoint - target));
+
+    if(target == 0 && fabsf(measured) < 1.f) {
+        // standing, don't hum against the static friction
+        integral = 0;
+        return 0;
+    }
+
+    const float err = target - measured;
+    const float ff = gains.kff * target + (target > 0 ? gains.kStatic : target < 0 ? -gains.kStatic : 0);
+    const float unsaturated = ff + gains.kp * err + integral;
+
+    // anti-windup: stop integrating once the output is saturated in the direction of the error
+    if(!(unsaturated >= cfg.maxPower && err > 0) && !(unsaturated <= -cfg.maxPower && err < 0)) {
+        integral = std::max(-cfg.maxPower, std::min(cfg.maxPower, integral + gains.ki * err * dt));
+    }
+
+    return std::max(-cfg.maxPower, std::min(cfg.maxPower, ff + gains.kp * err + integral));
+}
+
+void VelocityController::update() {
+    const int64_t now = esp_timer_get_time();
+    // the first step, or after a long stall, must not ramp by a huge dt
+    const float dt = m_lastUs == 0 ? 0 : std::min(0.1f, (now - m_lastUs) * 1e-6f);
+    m_lastUs = now;
+
+    const Setpoint sp = m_setpoint.read();
+    const OdometrySnapshot odom = m_odometry.snapshot();
+
+    VelocityStatus s;
+    s.leftMeasured = odom.leftUmPerS / 1000.f;
+    s.rightMeasured = odom.rightUmPerS / 1000.f;
+    s.leftPower = lroundf(m_left.step(m_cfg.left, sp.left, s.leftMeasured, dt, m_cfg));
+    s.rightPower = lroundf(m_right.step(m_cfg.right, sp.right, s.rightMeasured, dt, m_cfg));
+    s.leftTarget = m_left.target;
+    s.rightTarget = m_right.target;
+
+    const bool resting = sp.left == 0 && sp.right == 0 && m_left.target == 0 && m_right.target == 0
+        && s.leftPower == 0 && s.rightPower == 0;
+    if(!resting || m_active) {
+        m_cfg.write(s.leftPower, s.rightPower, m_cfg.writeCtx);
+    }
+    m_active = !resting;
+    m_status.write(s);
+}
+
+};
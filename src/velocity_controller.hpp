@@ -0,0 +1,106 @@
+#pragma once
+
+// Closed-loop wheel speed: per wheel PI with feed-forward and anti-windup, on encoder
+// velocities from Odometry, with acceleration limits on the setpoint.
+
+#include <atomic>
+#include <esp_err.h>
+#include <stdint.h>
+
+#include "control_loop.hpp"
+#include "odometry.hpp"
+#include "seqlock.hpp"
+
+namespace control {
+
+// Sets the motor power in percent, -100 to 100, forward is positive.
+typedef void (*MotorWriter)(int8_t leftPct, int8_t rightPct, void *ctx);
+
+struct WheelGains {
+    // power % per mm/s of the target, plus what it takes to get moving at all
+    float kff = 0.12f;
+    float kStatic = 8.f;
+
+    // power % per mm/s of error, and per mm of accumulated error
+    float kp = 0.05f;
+    float ki = 0.6f;
+};
+
+struct VelocityControllerConfig {
+    MotorWriter write = nullptr;
+    void *writeCtx = nullptr;
+
+    // Separate, so a weaker motor gets its own feed-forward instead of a fixed trim.
+    WheelGains left;
+    WheelGains right;
+
+    // mm/s^2, braking is allowed to be harder
+    float maxAccel = 1000.f;
+    float maxDecel = 2500.f;
+
+    float maxPower = 100.f;
+};
+
+struct VelocityStatus {
+    // mm/s, after the acceleration limits
+    float leftTarget;
+    float rightTarget;
+    float leftMeasured;
+    float rightMeasured;
+    // percent
+    int8_t leftPower;
+    int8_t rightPower;
+};
+
+class VelocityController {
+public:
+    VelocityController(const VelocityControllerConfig& cfg, const Odometry& odometry);
+
+    // Registers update() with the control::Runtime.
+    esp_err_t start(const LoopConfig& loop);
+
+    // One control step, called by the loop. Only ever from one task.
+    void update();
+
+    // Wheel speeds in mm/s, reached within the acceleration limits.
+    // From one task at a time, does not block.
+    void setVelocity(float leftMmPerS, float rightMmPerS);
+    void stop() { setVelocity(0, 0); }
+
+    // The motors are only written from the first non-zero setVelocity until the robot has
+    // stopped again, with one last zero. In between they are free for other code, e.g. the
+    // RBController joystick.
+    bool active() const { return m_active; }
+
+    VelocityStatus status() const { return m_status.read(); }
+
+private:
+    VelocityController(const VelocityController&) = delete;
+
+    struct Setpoint {
+        float left;
+        float right;
+    };
+
+    struct Wheel {
+        float target = 0;
+        float integral = 0;
+
+        float step(const WheelGains& gains, float setpoint, float measured, float dt, const VelocityControllerConfig& cfg);
+    };
+
+    VelocityControllerConfig m_cfg;
+    const Odometry& m_odometry;
+
+    SeqLock<Setpoint> m_setpoint;
+    SeqLock<VelocityStatus> m_status;
+
+    // only touched by update()
+    Wheel m_left;
+    Wheel m_right;
+    int64_t m_lastUs;
+
+    std::atomic<bool> m_active;
+};
+
+};
@@ -0,0 +1,77 @@
+#include <esp_log.h>
+#include <string.h>
+
+#include "web_ui.hpp"
+
+namespace web {
+
+static const char *TAG = "web";
+
+WebUi::WebUi() : m_server(nullptr) {}
+
+WebUi::~WebUi() {
+    stop();
+}
+
+esp_err_t WebUi::start(uint16_t port) {
+    if(m_server != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+    cfg.server_port = port;
+    // the default control port would clash with any other httpd instance
+    cfg.ctrl_port = port + 1;
+    cfg.max_uri_handlers = ASSET_COUNT + 1;
+
+    esp_err_t err = httpd_start(&m_server, &cfg);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to start the server on port %d: %d", port, err);
+        m_server = nullptr;
+        return err;
+    }
+
+    for(size_t i = 0; i < ASSET_COUNT; ++i) {
+        httpd_uri_t uri = {};
+        uri.uri = ASSETS[i].path;
+        uri.method = HTTP_GET;
+        uri.handler = handle;
+        uri.user_ctx = (void*)&ASSETS[i];
+        httpd_register_uri_handler(m_server, &uri);
+
+        if(strcmp(ASSETS[i].path, "/index.html") == 0) {
+            uri.uri = "/";
+            httpd_register_uri_handler(m_server, &uri);
+        }
+    }
+    return ESP_OK;
+}
+
+void WebUi::stop() {
+    if(m_server != nullptr) {
+        httpd_stop(m_server);
+        m_server = nullptr;
+    }
+}
+
+esp_err_t WebUi::handle(httpd_req_t *req) {
+    const auto *asset = (const Asset*)req->user_ctx;
+
+    // no-cache still lets the browser keep it, it just has to ask first
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char etag[24];
+    if(httpd_req_get_hdr_value_str(req, "If-None-Match", etag, sizeof(etag)) == ESP_OK
+        && strcmp(etag, asset->etag) == 0) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    httpd_resp_set_type(req, asset->contentType);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    // straight from flash, the server does not copy it anywhere first
+    return httpd_resp_send(req, (const char*)asset->data, asset->size);
+}
+
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+// Serves the control page straight from flash: the gzipped files from data/ are compiled in
+// by scripts/embed_web_assets.py, nothing is read from a filesystem. Every response carries
+// an ETag, browsers revalidate with If-None-Match and mostly get an empty 304 back.
+//
+// With rbcontroller_app_enable, the roboruka library still mounts SPIFFS and serves the same
+// page on port 80 itself, and the app protocol depends on that flag, so this server runs
+// next to it on another port (main.cpp) and the mount at boot stays.
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace web {
+
+struct Asset {
+    const char *path;
+    const char *contentType;
+    // quoted, as sent in the header
+    const char *etag;
+    // gzipped
+    const uint8_t *data;
+    size_t size;
+};
+
+// generated, src/web_assets.gen.cpp
+extern const Asset ASSETS[];
+extern const size_t ASSET_COUNT;
+
+class WebUi {
+public:
+    WebUi();
+    ~WebUi();
+
+    // "/" serves /index.html.
+    esp_err_t start(uint16_t port = 80);
+    void stop();
+
+private:
+    WebUi(const WebUi&) = delete;
+
+    static esp_err_t handle(httpd_req_t *req);
+
+    httpd_handle_t m_server;
+};
+
+};